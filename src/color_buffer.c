@@ -24,23 +24,33 @@
  */
 
 #include "color_buffer.h"
-#include <search.h>
+
+
+/**
+   Pack a color into a hash key. Only the high byte of the channels is
+   kept, the same precision is used in the names of the color tags.
+
+   @param color GDK color
+   @return the packed RGB value as a pointer
+*/
+static inline gpointer
+color_buffer_key(const GdkColor * color)
+{
+    return GUINT_TO_POINTER(((color->red & 0xff00) << 8) |
+                            (color->green & 0xff00) | (color->blue >> 8));
+}
 
 
 ColorBuffer *
-color_buffer_create(GtkTextBuffer * text_buffer,
-                    const gchar * tag_attribute, gint size)
+color_buffer_create(GtkTextTagTable * tag_table, const gchar * tag_attribute)
 {
     ColorBuffer *color_buffer = NULL;
 
     color_buffer = g_new0(ColorBuffer, 1);
 
-    color_buffer->text_buffer = text_buffer;
+    color_buffer->tag_table = tag_table;
     color_buffer->tag_attribute = tag_attribute;
-    color_buffer->size = size;
-    color_buffer->current_size = 0;
-    color_buffer->last = 0;
-    color_buffer->elements = g_new0(ColorBufferElement, size);
+    color_buffer->tags = g_hash_table_new(g_direct_hash, g_direct_equal);
 
     return color_buffer;
 }
@@ -48,14 +58,11 @@ color_buffer_create(GtkTextBuffer * text_buffer,
 void
 color_buffer_destroy(ColorBuffer * color_buffer)
 {
-    g_free(color_buffer->elements);
-    color_buffer->text_buffer = NULL;
+    g_hash_table_destroy(color_buffer->tags);
+    color_buffer->tag_table = NULL;
     /* Tag attribute string is not freed. */
     color_buffer->tag_attribute = NULL;
-    color_buffer->elements = NULL;
-    color_buffer->size = 0;
-    color_buffer->current_size = 0;
-    color_buffer->last = 0;
+    color_buffer->tags = NULL;
     g_free(color_buffer);
 }
 
@@ -64,115 +71,24 @@ void
 color_buffer_add(ColorBuffer * color_buffer, const GdkColor * color,
                  GtkTextTag * tag)
 {
-    gint current_size = 0;
-    gint index = 0;
-
     /* Do not allow items with NULL tag. */
+    g_return_if_fail(tag != NULL);
 
-    current_size = color_buffer->current_size;
-    if (current_size < color_buffer->size)
-    {
-        color_buffer->elements[current_size].color = *color;
-        color_buffer->elements[current_size].tag = tag;
-        color_buffer->last = current_size;
-        color_buffer->current_size++;
-    }
-    else
-    {
-        index = color_buffer->last + 1;
-        if (index >= color_buffer->size)
-        {
-            index = 0;
-        }
-        color_buffer->elements[index].color = *color;
-        color_buffer->elements[index].tag = tag;
-        color_buffer->last = index;
-        color_buffer->current_size = color_buffer->size;
-    }
+    g_hash_table_insert(color_buffer->tags, color_buffer_key(color), tag);
 }
 
 
-int
-color_buffer_compare_elements(const void *elem1, const void *elem2)
-{
-    const ColorBufferElement *el1 = NULL;
-    const ColorBufferElement *el2 = NULL;
-
-    el1 = (const ColorBufferElement *) elem1;
-    el2 = (const ColorBufferElement *) elem2;
-    if (el1->color.red < el2->color.red)
-    {
-        return -1;
-    }
-    else if (el1->color.red > el2->color.red)
-    {
-        return 1;
-    }
-    else if (el1->color.green < el2->color.green)
-    {
-        return -1;
-    }
-    else if (el1->color.green > el2->color.green)
-    {
-        return 1;
-    }
-    else if (el1->color.blue < el2->color.blue)
-    {
-        return -1;
-    }
-    else if (el1->color.blue > el2->color.blue)
-    {
-        return 1;
-    }
-    else if (el1->color.pixel < el2->color.pixel)
-    {
-        return -1;
-    }
-    else if (el1->color.pixel > el2->color.pixel)
-    {
-        return 1;
-    }
-    else
-    {
-        return 0;
-    }
-}
-
-
-ColorBufferElement *
-color_buffer_search(ColorBuffer * color_buffer, const GdkColor * color)
+void
+color_buffer_remove(ColorBuffer * color_buffer, const GdkColor * color)
 {
-    ColorBufferElement *element = NULL;
-    ColorBufferElement target;
-    size_t current_size = 0;
-
-    target.color = *color;
-    target.tag = NULL;
-    current_size = color_buffer->current_size;
-    element = lfind(&target,
-                    color_buffer->elements,
-                    &current_size,
-                    sizeof(ColorBufferElement),
-                    color_buffer_compare_elements);
-
-    return element;
+    g_hash_table_remove(color_buffer->tags, color_buffer_key(color));
 }
 
 
 GtkTextTag *
 color_buffer_query_tag(ColorBuffer * color_buffer, const GdkColor * color)
 {
-    ColorBufferElement *element = NULL;
-
-    element = color_buffer_search(color_buffer, color);
-    if (element != NULL)
-    {
-        return element->tag;
-    }
-    else
-    {
-        return NULL;
-    }
+    return g_hash_table_lookup(color_buffer->tags, color_buffer_key(color));
 }
 
 
@@ -181,8 +97,7 @@ color_buffer_create_tag(ColorBuffer * color_buffer,
                         const GdkColor * color, gint priority)
 {
     GtkTextTag *tag = NULL;
-    GtkTextTagTable *tbl =
-        gtk_text_buffer_get_tag_table(color_buffer->text_buffer);
+    GtkTextTagTable *tbl = color_buffer->tag_table;
 
     /* Does the tag have a copy of the color? */
     gchar *tmp =
@@ -190,9 +105,12 @@ color_buffer_create_tag(ColorBuffer * color_buffer,
                         color->green / 256, color->blue / 256);
     tag = gtk_text_tag_table_lookup(tbl, tmp);
     if (!tag)
-        tag = gtk_text_buffer_create_tag(color_buffer->text_buffer, tmp,
-                                         color_buffer->tag_attribute, color,
-                                         NULL);
+    {
+        tag = gtk_text_tag_new(tmp);
+        g_object_set(G_OBJECT(tag), color_buffer->tag_attribute, color, NULL);
+        gtk_text_tag_table_add(tbl, tag);
+        g_object_unref(tag);
+    }
     g_free(tmp);
     gtk_text_tag_set_priority(tag, priority);
     return tag;
@@ -203,19 +121,13 @@ GtkTextTag *
 color_buffer_get_tag(ColorBuffer * color_buffer,
                      const GdkColor * color, gint priority)
 {
-    ColorBufferElement *element = NULL;
     GtkTextTag *tag = NULL;
 
-
-    element = color_buffer_search(color_buffer, color);
-    if (element != NULL)
-    {
-        return element->tag;
-    }
-    else
+    tag = color_buffer_query_tag(color_buffer, color);
+    if (tag == NULL)
     {
         tag = color_buffer_create_tag(color_buffer, color, priority);
         color_buffer_add(color_buffer, color, tag);
-        return tag;
     }
+    return tag;
 }
@@ -31,30 +31,22 @@
 #include <gtk/gtk.h>
 #include <gdk/gdk.h>
     typedef struct {
-    GdkColor color;
-    GtkTextTag *tag;
-} ColorBufferElement;
-
-typedef struct {
-    GtkTextBuffer *text_buffer;
+    GtkTextTagTable *tag_table;
     const gchar *tag_attribute;
-    gint size;
-    gint current_size;
-    gint last;
-    ColorBufferElement *elements;
+    /* Maps the packed RGB value of a color to it's GTK tag */
+    GHashTable *tags;
 } ColorBuffer;
 
 
 /**
    Create a ColorBuffer object.
 
-   @param text_buffer GtkTextBuffer object
+   @param tag_table GtkTextTagTable object, where the tags are created
    @param tag_attribute GTK attribute name for tags
-   @param size size of the color buffer
    @return created ColorBuffer object
 */
-ColorBuffer *color_buffer_create(GtkTextBuffer * text_buffer,
-                                 const gchar * tag_attribute, gint size);
+ColorBuffer *color_buffer_create(GtkTextTagTable * tag_table,
+                                 const gchar * tag_attribute);
 
 
 /**
@@ -66,7 +58,9 @@ void color_buffer_destroy(ColorBuffer * color_buffer);
 
 
 /**
-   Add a pair consisting a color and GTK tag to a color buffer
+   Add a pair consisting a color and GTK tag to a color buffer.
+   Colors are distinguished by their 8 bit per channel RGB value,
+   an already stored tag for the same value is replaced.
 
    @param color_buffer ColorBuffer object
    @param color GDK color
@@ -77,29 +71,12 @@ void color_buffer_add(ColorBuffer * color_buffer, const GdkColor * color,
 
 
 /**
-   Compare two ColorBufferElement objects.
-   Used internally for searching.
-
-   @param elem1 element 1
-   @param elem2 element 2
-   @return
-   -1 if element 1 <  element 2
-   0  if element 1 == element 2
-   1  if element 1 >  element 2
-*/
-int color_buffer_compare_elements(const void *elem1, const void *elem2);
-
-
-/**
-   Search an element from a color buffer by color
+   Remove a color from a color buffer. The tag itself is not touched.
 
    @param color_buffer ColorBuffer object
    @param color GDK color
-   @return pointer to the element in the color buffer
-   NULL if no element for the given color is not found in the color buffer
-*/
-ColorBufferElement *color_buffer_search(ColorBuffer * color_buffer,
-                                        const GdkColor * color);
+ */
+void color_buffer_remove(ColorBuffer * color_buffer, const GdkColor * color);
 
 
 /**
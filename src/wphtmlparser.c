@@ -34,6 +34,7 @@
 #include <ctype.h>
 
 #include "wphtmlparser.h"
+#include "wptextbuffer-private.h"
 
 #define MAX_TAG_LENGTH 100
 #define MAX_TAG_ATTR_LENGTH 100
@@ -60,15 +61,6 @@ typedef enum {
     ST_SCRIPT
 } HTMLState;
 
-/** List type */
-typedef enum {
-    LT_NONE,
-    LT_BULLET,
-    LT_NUM,
-    LT_LC_ALPHA,
-    LT_UC_ALPHA
-} HTMLListType;
-
 /** Font type */
 typedef struct {
     gint font;
@@ -127,10 +119,8 @@ struct _WPHTMLParser {
     gint is_script:1;
 
     // Bullets and numbering
-    /** Number of the last used list entry */
-    gint list_number;
     /** Type of the list */
-    HTMLListType list_type;
+    WPListType list_type;
 
     /** Pointer to a #WPTextBuffer */
     WPTextBuffer *buffer;
@@ -356,12 +346,32 @@ html_write_text(WPHTMLParser * parser)
     if (*parser->last_text)
     {
         GtkTextIter iter;
+        guint8 *types;
+        gint line, last;
 
         gtk_text_buffer_get_end_iter(GTK_TEXT_BUFFER(parser->buffer), &iter);
+        line = gtk_text_iter_get_line(&iter);
         wp_text_buffer_insert_with_attribute(parser->buffer, &iter,
                                              parser->last_text, -1,
                                              &parser->fmt, TRUE);
 
+        /* The new lines would continue the list of the line, they get
+         * their own list type with their first text */
+        gtk_text_buffer_get_end_iter(GTK_TEXT_BUFFER(parser->buffer), &iter);
+        last = gtk_text_iter_get_line(&iter);
+        if (last > line)
+        {
+            types = g_new0(guint8, last - line);
+            _wp_text_buffer_set_list_types(parser->buffer, line + 1, types,
+                                           last - line);
+            g_free(types);
+        }
+
+        /* The bullet is put by the buffer, the numbering is set here */
+        if (parser->fmt.bullet && parser->list_type > WP_LIST_BULLET)
+            _wp_text_buffer_set_line_list_type(parser->buffer, line,
+                                               parser->list_type);
+
         parser->last_line_justification = parser->fmt.justification;
         // printf("Text: '%s'\n", parser->last_text);
     }
@@ -1052,7 +1062,7 @@ process_tag_ul(WPHTMLParser * parser)
 {
     html_insert_newline(parser, FALSE);
 
-    parser->list_type = parser->is_close_tag ? LT_NONE : LT_BULLET;
+    parser->list_type = parser->is_close_tag ? WP_LIST_NONE : WP_LIST_BULLET;
     // need this, if the html syntax is not correct
     parser->fmt.bullet = !parser->is_close_tag;
 }
@@ -1062,38 +1072,30 @@ process_tag_ol(WPHTMLParser * parser)
 {
     html_insert_newline(parser, FALSE);
 
-    /* Numbering need to be implemented in the editor ! */
     if (parser->is_first_attr && !parser->is_close_tag)
-    {
-        parser->list_number = 1;
-        parser->list_type = LT_NUM;
-    }
+        parser->list_type = WP_LIST_NUMBER;
     else if (parser->is_close_tag)
-        parser->list_type = LT_NONE;
+        parser->list_type = WP_LIST_NONE;
 
+    /* The items are always numbered from the first one, the start attribute
+     * is not kept */
     if (!parser->is_close_tag)
     {
-        if (strcmp(parser->last_tag_attr, "start") == 0)
-        {
-            parser->list_type = atoi(parser->last_tag_value);
-            if (parser->list_type)
-                --parser->list_type;
-        }
-        else if (strcmp(parser->last_tag_attr, "type") == 0)
+        if (strcmp(parser->last_tag_attr, "type") == 0)
         {
             switch (*parser->last_tag_value)
             {
                 case '1':
-                    parser->list_type = LT_NUM;
+                    parser->list_type = WP_LIST_NUMBER;
                     break;
                 case 'a':
-                    parser->list_type = LT_LC_ALPHA;
+                    parser->list_type = WP_LIST_LOWER_ALPHA;
                     break;
                 case 'A':
-                    parser->list_type = LT_UC_ALPHA;
+                    parser->list_type = WP_LIST_UPPER_ALPHA;
                     break;
                 default:
-                    parser->list_type = LT_NUM;
+                    parser->list_type = WP_LIST_NUMBER;
             }
         }
     }
@@ -1102,11 +1104,10 @@ process_tag_ol(WPHTMLParser * parser)
 static void
 process_tag_li(WPHTMLParser * parser)
 {
-    if (parser->list_type != LT_NONE)
+    if (parser->list_type != WP_LIST_NONE)
     {
         html_insert_newline(parser, FALSE);
 
-        ++parser->list_number;
         parser->fmt.bullet = !parser->is_close_tag;
         parser->fmt.cs.bullet = !parser->is_close_tag;
     }
@@ -1115,12 +1116,11 @@ process_tag_li(WPHTMLParser * parser)
 /**
  * Process a font face attribute
  * @param parser is a #WPHTMLParser
- * @param name is the name of the font
+ * @param name is the name of the font, or a comma separated list of names
  */
 static void
 process_font_face(WPHTMLParser * parser, gchar * name)
 {
-    // TODO: Should we support multiple font names separated by ',' ?
     parser->fmt.font = wp_get_font_index(name, parser->default_fmt.font);
 }
 
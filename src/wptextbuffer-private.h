@@ -36,51 +36,24 @@
 
 G_BEGIN_DECLS
 /**
- * Queries if the position at <i>iter</i> contains opened <i>tag</i>
- * @param iter a position in the buffer
- * @param tag a #GtkTextTag, usually the bullet tag
- * @return <b>TRUE</b> if the <i>tag</i> is opened at <i>iter</i>
- */
-    gboolean _wp_text_iter_is_bullet(GtkTextIter * iter, GtkTextTag * tag);
-
-/**
- * Skip the <i>tag</i> at the <i>iter</i> position in <i>forward</i> direction
- * @param iter a position in the buffer
- * @param tag a #GtkTextTag, usually the bullet tag
- * @param forward set to <b>TRUE</b> if the skip is happening forward
- * @return <b>TRUE</b> if there was a <i>tag</i> at the <i>iter</i> position
- */
-gboolean _wp_text_iter_skip_bullet(GtkTextIter * iter, GtkTextTag * tag,
-                                   gboolean forward);
-/**
- * Queries if a the line specified by <i>iter</i> contains the <i>tag</i> at the
- * begining. Modify the position to <i>iter</i> to the begin of the line
- * @param iter a position in the buffer
- * @param tag a #GtkTextTag, usually the bullet tag
- * @return <b>TRUE</b> if the <i>tag</i> has been found
- */
-gboolean _wp_text_iter_has_bullet(GtkTextIter * iter, GtkTextTag * tag);
-
-/**
- * Puts a <i>tag</i> at the begining of the line specified by <i>iter</i>
- * @param iter a position in the buffer
- * @param tag a #GtkTextTag, usually the bullet tag
- * @return <b>TRUE</b> if there was no <i>tag</i> at the begining of the line
+ * Queries the image id associated to an image <i>tag</i>
+ * @param buffer pointer to a #WPTextBuffer
+ * @param tag a #GtkTextTag
+ * @return the image id or <b>NULL</b> if <i>tag</i> is not an image tag
  */
-gboolean _wp_text_iter_put_bullet_line(GtkTextIter * iter, GtkTextTag * tag);
+const gchar *_wp_text_buffer_get_image_id(WPTextBuffer * buffer,
+                                          GtkTextTag * tag);
 
 /**
- * Removes a <i>tag</i> from the begining of the line specified by <i>iter</i>
- * @param iter a position in the buffer
- * @param tag a #GtkTextTag, usually the bullet tag
- */
-void _wp_text_iter_remove_bullet_line(GtkTextIter * iter, GtkTextTag * tag);
-/**
- * Queries the #GtkTextTag used for delimiting a bullet
+ * Queries the tag of the placeholders waiting for the image <i>image_id</i>
  * @param buffer pointer to a #WPTextBuffer
- * @return the bullet tag
+ * @param image_id the image id
+ * @param create is <b>TRUE</b> if the tag should be created when missing
+ * @return the tag or <b>NULL</b> if there is no such tag
  */
-GtkTextTag *_wp_text_buffer_get_bullet_tag(WPTextBuffer * buffer);
+GtkTextTag *_wp_text_buffer_get_image_replace_tag(WPTextBuffer * buffer,
+                                                  const gchar * image_id,
+                                                  gboolean create);
 
 /**
  * Modify the justification of the text delimited by <i>start</i> and
@@ -98,6 +71,36 @@ void _wp_text_buffer_adjust_justification(WPTextBuffer * buffer,
                                           GtkTextTag * def_tag,
                                           gboolean align_to_right);
 
+/**
+ * Set the list type of a single line. The text is not changed, only the
+ * paragraph table of the <i>buffer</i>.
+ * @param buffer pointer to a #WPTextBuffer
+ * @param line is a line number in the buffer
+ * @param type is a #WPListType
+ */
+void _wp_text_buffer_set_line_list_type(WPTextBuffer * buffer, gint line,
+                                        WPListType type);
+
+/**
+ * Set the list types of <i>count</i> lines from <i>first</i>, recording the
+ * old types in the undo
+ * @param buffer pointer to a #WPTextBuffer
+ * @param first is the first line
+ * @param types holds a #WPListType for every line
+ * @param count is the number of elements in <i>types</i>
+ */
+void _wp_text_buffer_set_list_types(WPTextBuffer * buffer, gint first,
+                                    const guint8 * types, gint count);
+
+/**
+ * Get the label drawn in front of a numbered list item, like "3." or "c."
+ * @param buffer pointer to a #WPTextBuffer
+ * @param line is a line number in the buffer
+ * @return the newly allocated label or <b>NULL</b> if the line is not
+ *         part of a numbered list
+ */
+gchar *_wp_text_buffer_get_list_label(WPTextBuffer * buffer, gint line);
+
 /**
  * Set the remember_tag flag to true. It is used, to remember the deleted tags
  * @param buffer pointer to a #WPTextBuffer
@@ -29,16 +29,129 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <glib-object.h>
 #include <gtk/gtk.h>
+#include <fontconfig/fontconfig.h>
 #include "wptextbuffer.h"
 #include "color_buffer.h"
 #include "wptextbuffer-private.h"
 #include "wpundo.h"
 #include "wphtmlparser.h"
 
-#define WPT_ID "wpt-id"
+/** Categories of the tags owned by a buffer, stored in #WPTagInfo */
+typedef enum {
+    /** Simple formatting tag, the index is one of the WPT_x ids */
+    WPT_CAT_SIMPLE = 0,
+    /** Normal font size tag, the index is the font size index */
+    WPT_CAT_FONT_SIZE,
+    /** Superscript tag, the index is the font size index */
+    WPT_CAT_SUP_SRPT,
+    /** Subscript tag, the index is the font size index */
+    WPT_CAT_SUB_SRPT,
+    /** Font face tag, the index is the font index */
+    WPT_CAT_FONT,
+    /** Foreground color tag */
+    WPT_CAT_COLOR,
+    /** Image tag. The index is 0 for the tag of an image id and 1 for the
+     * tag of its placeholders, these have the image id set. The index is 2
+     * for the tag marking every image. */
+    WPT_CAT_IMAGE
+} WPTagCategory;
+
+/** Metadata kept by the buffer for each tag it owns */
+typedef struct {
+    /** One of the #WPTagCategory */
+    guint8 category;
+    /** <b>TRUE</b> if the tag is created on demand, and can be collected
+     * when it is not used anymore */
+    guint8 dynamic:1;
+    /** Index inside the category */
+    gint index;
+    /** Image id for #WPT_CAT_IMAGE tags, owned by the record */
+    gchar *image_id;
+} WPTagInfo;
+
+/** Number of font scaling factors with cached tag sizes */
+#define SIZE_TABLE_CACHE 4
+
+/** Sizes and rises of the size tags, computed for a font scaling factor */
+typedef struct {
+    /** The font scaling factor */
+    gdouble scale;
+    /** Sizes of the font size tags, in pango units */
+    gint size[WP_FONT_SIZE_COUNT];
+    /** Sizes of the superscript and subscript tags, in pango units */
+    gint sup_sub_size[WP_FONT_SIZE_COUNT];
+    /** Rises of the superscript tags, in pango units */
+    gint sup_rise[WP_FONT_SIZE_COUNT];
+    /** Rises of the subscript tags, in pango units */
+    gint sub_rise[WP_FONT_SIZE_COUNT];
+} WPSizeTable;
+
+/** Formatting tags of a #GtkTextTagTable, shared by all the buffers using
+ * the table */
+typedef struct {
+    /** #GtkTextTag array of tags less then WPT_LASTTAG */
+    GtkTextTag *tags[WPT_LASTTAG];
+    /** Pointer to the ColorBuffer */
+    ColorBuffer *color_tags;
+    /** #GtkTextTag array of font size tags */
+    GtkTextTag *font_size_tags[WP_FONT_SIZE_COUNT];
+    /** #GtkTextTag array of superscript tags */
+    GtkTextTag *font_size_sup_tags[WP_FONT_SIZE_COUNT];
+    /** #GtkTextTag array of subscript tags */
+    GtkTextTag *font_size_sub_tags[WP_FONT_SIZE_COUNT];
+    /** #GtkTextTag array of font face tags, allocated at the first use */
+    GtkTextTag **fonts;
+    /** Number of elements of <i>fonts</i>, grown with the font list */
+    gint n_fonts;
+    /** Maps the #GtkTextTag's of the set to their #WPTagInfo */
+    GHashTable *tag_hash;
+    /** The tag table holding the tags */
+    GtkTextTagTable *table;
+    /** List of the #WPTextBuffer's using the tag set */
+    GSList *buffers;
+    /** Tag sizes of the last used scaling factors, the most recent first */
+    WPSizeTable size_tables[SIZE_TABLE_CACHE];
+    /** Number of valid elements in <i>size_tables</i> */
+    gint n_size_tables;
+    /** Maps the image ids to their #WPImageEntry. The image tags belong to
+     * the tag table, so the images of all the buffers are registered here */
+    GHashTable *images;
+    /** Tag applied to every image inserted to the buffers, with or without
+     * image id */
+    GtkTextTag *image_tag;
+} WPTagSet;
+
+/** The tags belonging to an image id, looked up at their first use */
+typedef struct {
+    /** Tag applied to the inserted image */
+    GtkTextTag *tag;
+    /** Tag applied to the placeholders waiting for the image */
+    GtkTextTag *replace_tag;
+} WPImageEntry;
+
+/** Paragraph attributes of a line. The justification is resolved from the
+ * tags at its start, the list type is kept only here: the text holds no
+ * bullet, the view paints them. */
+typedef struct {
+    /** Justification tag of the line, <b>NULL</b> if it has none */
+    GtkTextTag *justification;
+    /** <b>TRUE</b> if <i>justification</i> is up to date. The tags have to
+     * be looked up again for invalid entries. */
+    guint valid:1;
+    /** #WPListType of the line */
+    guint list:3;
+    /** Number of the item in a numbered list, 0 if not computed yet */
+    gint number;
+} WPParagraph;
+
+/** Delay of the refresh_attributes signal after the last cursor movement,
+ * in milliseconds */
+#define REFRESH_ATTRIBUTES_DELAY 400
 
 #define MIN_FONT_SCALE 0.1
 #define MAX_FONT_SCALE 5
@@ -94,22 +207,24 @@ struct _WPTextBufferPrivate {
     /** Last line justification from the deleted text */
     gint delete_last_line_justification;
 
+    /** Tag set of the tag table, the tag pointers below point into it */
+    WPTagSet *tag_set;
     /** #GtkTextTag array of tags less then WPT_LASTTAG */
-    GtkTextTag *tags[WPT_LASTTAG];
+    GtkTextTag **tags;
     /** Pointer to the ColorBuffer */
     ColorBuffer *color_tags;
     /** #GtkTextTag array of font size tags */
-    GtkTextTag *font_size_tags[WP_FONT_SIZE_COUNT];
+    GtkTextTag **font_size_tags;
     /** #GtkTextTag array of superscript tags */
-    GtkTextTag *font_size_sup_tags[WP_FONT_SIZE_COUNT];
+    GtkTextTag **font_size_sup_tags;
     /** #GtkTextTag array of subscript tags */
-    GtkTextTag *font_size_sub_tags[WP_FONT_SIZE_COUNT];
-
-    /** #GtkTextTag array of font face tags */
-    GtkTextTag **fonts;
+    GtkTextTag **font_size_sub_tags;
 
     /** Idle id, used to emit refresh_attributes signal */
     gint source_refresh_attributes;
+    /** Monotonic time (in microseconds) when the pending refresh_attributes
+     * signal is due. Moved forward by every cursor movement. */
+    gint64 refresh_deadline;
 
     /** Last line justification */
     gint last_line_justification;
@@ -129,6 +244,10 @@ struct _WPTextBufferPrivate {
 
     /** Tag rememberence status. It is needed for special IM cases */
     gint remember_tag:1;
+    /** Set when the selection has disappeared and its undo operation has been
+     * closed. Until a new selection, the undo has nothing to record about
+     * the cursor movements. */
+    gint select_closed:1;
 
     /** True is insert was the last operation */
     gint last_is_insert:1;
@@ -136,7 +255,32 @@ struct _WPTextBufferPrivate {
     gint convert_tag:1;
     GSList *copy_insert_tags;
     GtkTextIter copy_start, copy_end;
+    /** Maps the #GtkTextTag's of the tag set to their #WPTagInfo */
     GHashTable *tag_hash;
+
+    /** Edit generation, incremented at every change of the text or tags */
+    guint generation;
+    /** Generation in which <i>run_fmt</i> was resolved */
+    guint run_generation;
+    /** Offsets of the run of characters sharing the tags of <i>run_fmt</i> */
+    gint run_start, run_end;
+    /** Format resolved from the tags of the run at the cursor */
+    WPTextBufferFormat run_fmt;
+    /** #GArray of #WPParagraph, one for every line of the buffer */
+    GArray *paragraphs;
+    /** Line of the text change in progress, -1 if there is none. The parent
+     * class emits changed before the hook returns, so the table is brought
+     * up to date on demand */
+    gint paragraph_change;
+    /** <b>TRUE</b> if the change in progress is at the start of its line */
+    gboolean paragraph_change_start;
+    /** Number of the lines with a list type */
+    gint list_lines;
+
+    /** Attributes sent by the last refresh_format signal */
+    WPTextBufferFormat refresh_fmt;
+    /** <b>TRUE</b> if <i>refresh_fmt</i> has been sent */
+    gboolean refresh_fmt_valid;
 };
 
 /** HTML tag types */
@@ -177,6 +321,22 @@ const gchar *html_close_tags[TP_LAST] = { "</font>",
     "</sup>"
 };
 
+/** HTML list opening tags, indexed by #WPListType */
+const gchar *html_list_open_tags[WP_LIST_LAST] = { "",
+    "<ul>\n",
+    "<ol>\n",
+    "<ol type=\"a\">\n",
+    "<ol type=\"A\">\n"
+};
+
+/** HTML list closing tags, indexed by #WPListType */
+const gchar *html_list_close_tags[WP_LIST_LAST] = { "",
+    "</ul>\n",
+    "</ol>\n",
+    "</ol>\n",
+    "</ol>\n"
+};
+
 /** HTML header */
 const gchar *html_header =
     "<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.01 Transitional//EN\" \"http://www.w3.org/TR/html4/loose.dtd\">\n"
@@ -282,6 +442,14 @@ static void wp_text_buffer_end_user_action(GtkTextBuffer * buffer);
  */
 static void emit_refresh_attributes(WPTextBuffer * buffer,
                                     const GtkTextIter * iter);
+/**
+ * Send the refresh_attributes signal, followed by the refresh_format signal
+ * if somebody is listening and the attributes at the cursor has changed
+ * since it was sent the last time. The attributes are taken from the
+ * format cached for the cursor.
+ * @param buffer is a #WPTextBuffer
+ */
+static void emit_refresh_signals(WPTextBuffer * buffer);
 /**
  * Send the default_font_changed signal
  * @param buffer is a #WPTextBuffer
@@ -420,6 +588,133 @@ static void wp_text_buffer_no_memory_cb(WPUndo * undo, WPTextBuffer * buffer);
  */
 static void wp_text_buffer_resize_font(WPTextBuffer * buffer);
 
+/**
+ * Check if <i>tag</i> is applied to any character between <i>start</i> and
+ * <i>end</i>. Only the toggles of the <i>tag</i> are visited.
+ * @param tag is a #GtkTextTag
+ * @param start a position in the buffer
+ * @param end a position in the buffer
+ * @return <b>TRUE</b> if <i>tag</i> is present in the interval
+ */
+static gboolean tag_in_range(GtkTextTag * tag, const GtkTextIter * start,
+                             const GtkTextIter * end);
+
+/**
+ * Check if there is an image between <i>start</i> and <i>end</i>. Every
+ * image gets the image tag of the tag set when it is inserted, so only its
+ * toggles are checked.
+ * @param buffer is a #WPTextBuffer
+ * @param start a position in the buffer
+ * @param end a position in the buffer
+ * @return <b>TRUE</b> if an image is found
+ */
+static gboolean range_has_image(WPTextBuffer * buffer,
+                                const GtkTextIter * start,
+                                const GtkTextIter * end);
+
+/**
+ * Remove the registered tags from the interval between <i>start</i> and
+ * <i>end</i>, before deleting it. Each tag present in the interval is
+ * removed once, so the B-tree doesn't have to drop the toggles one by one
+ * while deleting. Nothing is done if no tag toggles inside the interval.
+ * The removal is not saved in the undo.
+ * @param buffer is a #WPTextBuffer
+ * @param start a position in the buffer
+ * @param end a position in the buffer
+ */
+static void clear_range_tags(WPTextBuffer * buffer, GtkTextIter * start,
+                             GtkTextIter * end);
+
+/**
+ * Get the tag sizes for the font scaling factor <i>scale</i>. The sizes of
+ * the last #SIZE_TABLE_CACHE factors are kept, so switching between zoom
+ * levels doesn't compute them again.
+ * @param set is a #WPTagSet
+ * @param scale is the font scaling factor
+ * @return the #WPSizeTable, owned by the <i>set</i>
+ */
+static const WPSizeTable *get_size_table(WPTagSet * set, double scale);
+
+/**
+ * Set the size and rise of a font size, superscript or subscript tag. The
+ * properties which already has the right value are not set again, to not
+ * invalidate the layout of the text needlessly.
+ * @param tag is a #GtkTextTag
+ * @param category is #WPT_CAT_FONT_SIZE, #WPT_CAT_SUP_SRPT or
+ *                 #WPT_CAT_SUB_SRPT
+ * @param index is the font size index
+ * @param sizes is the #WPSizeTable of the font scaling factor
+ */
+static void set_size_tag_attributes(GtkTextTag * tag,
+                                    WPTagCategory category, gint index,
+                                    const WPSizeTable * sizes);
+
+/**
+ * Get the font size, superscript, subscript or font face tag from the tag
+ * set. The tags are created at their first use, so the tag table holds only
+ * the tags needed by the documents.
+ * @param priv is a pointer to #WPTextBufferPrivate
+ * @param category is #WPT_CAT_FONT_SIZE, #WPT_CAT_SUP_SRPT,
+ *                 #WPT_CAT_SUB_SRPT or #WPT_CAT_FONT
+ * @param index is the font size index or the font index
+ * @return the #GtkTextTag, or <b>NULL</b> if the font index is out of the
+ *         font list
+ */
+static GtkTextTag *get_format_tag(WPTextBufferPrivate * priv,
+                                  WPTagCategory category, gint index);
+
+/**
+ * Get the size tag of the text position <i>pos</i>
+ * @param priv is a pointer to #WPTextBufferPrivate
+ * @param pos is the text position
+ * @param size is the font size index
+ * @return the #GtkTextTag
+ */
+static GtkTextTag *get_position_tag(WPTextBufferPrivate * priv,
+                                    TextPosition pos, gint size);
+
+/**
+ * Get the paragraph attributes of the <i>line</i>. The justification is
+ * resolved from the tags at the start of the line, if it's not up to date.
+ * @param buffer pointer to a #WPTextBuffer
+ * @param line is a line number in the buffer
+ * @return the #WPParagraph, owned by the <i>buffer</i>
+ */
+static const WPParagraph *get_paragraph(WPTextBuffer * buffer, gint line);
+
+/**
+ * Record a text change starting at <i>line</i>, before it is passed to the
+ * parent class
+ * @param priv is a pointer to #WPTextBufferPrivate
+ * @param line is the line where the change happens
+ * @param line_start is <b>TRUE</b> if the change happens at the start of
+ *                   the <i>line</i>, so its first character changes
+ */
+static void begin_paragraph_change(WPTextBufferPrivate * priv, gint line,
+                                   gboolean line_start);
+
+/**
+ * Update the paragraph table after the change recorded by
+ * begin_paragraph_change. The new lines continue the list of the line where
+ * they were inserted, the entries of the removed lines are dropped. It does
+ * nothing if no change is in progress.
+ * @param buffer is a #WPTextBuffer
+ */
+static void update_paragraphs(WPTextBuffer * buffer);
+
+/**
+ * Invalidate the paragraph entries between <i>start</i> and <i>end</i>, if
+ * <i>tag</i> is a justification tag
+ * @param priv is a pointer to #WPTextBufferPrivate
+ * @param tag is the applied or removed #GtkTextTag
+ * @param start a position in the buffer
+ * @param end a position in the buffer
+ */
+static void invalidate_paragraphs(WPTextBufferPrivate * priv,
+                                  GtkTextTag * tag,
+                                  const GtkTextIter * start,
+                                  const GtkTextIter * end);
+
 /**
  * Marks the user action to reset the buffer
  */
@@ -431,6 +726,8 @@ static void wp_text_buffer_insert_pixbuf (GtkTextBuffer *buffer,
 enum {
     /** Sent when the attributes need to be refreshed */
     REFRESH_ATTRIBUTES,
+    /** Sent with the new attributes, when they has changed */
+    REFRESH_FORMAT,
     /** Sent when redo state has changed */
     CAN_REDO,
     /** Sent when undo state has changed */
@@ -445,6 +742,8 @@ enum {
     BACKGROUND_COLOR_CHANGED,
     /** Sent when there is not enough memory to perform the operation */
     NO_MEMORY,
+    /** Sent when the list types of the lines has been changed */
+    LIST_CHANGED,
     LAST_SIGNAL
 };
 
@@ -549,6 +848,57 @@ changeset_is_set(WPTextBufferFormatChangeSet *cs)
               cs->bullet);
 }
 
+/**
+ * Free a #WPTagInfo record, used as destroy function in the tag hash
+ * @param data pointer to a #WPTagInfo
+ */
+static void
+tag_info_free(gpointer data)
+{
+    WPTagInfo *info = (WPTagInfo *) data;
+
+    g_free(info->image_id);
+    g_free(info);
+}
+
+/**
+ * Register <i>tag</i> as owned by the buffer, and store it's metadata
+ * @param priv is a pointer to #WPTextBufferPrivate
+ * @param tag is a #GtkTextTag
+ * @param category is one of the #WPTagCategory
+ * @param index is the index of the tag inside the <i>category</i>
+ * @return the #WPTagInfo associated to the <i>tag</i>
+ */
+static WPTagInfo *
+register_tag(WPTextBufferPrivate * priv, GtkTextTag * tag,
+             WPTagCategory category, gint index)
+{
+    WPTagInfo *info = g_hash_table_lookup(priv->tag_hash, tag);
+
+    if (!info)
+    {
+        info = g_new0(WPTagInfo, 1);
+        g_hash_table_insert(priv->tag_hash, tag, info);
+    }
+    info->category = category;
+    info->index = index;
+    info->dynamic = category != WPT_CAT_SIMPLE;
+
+    return info;
+}
+
+/**
+ * Inline function to retrieve the metadata of a <i>tag</i>
+ * @param priv is a pointer to #WPTextBufferPrivate
+ * @param tag is a #GtkTextTag
+ * @return the #WPTagInfo or <b>NULL</b> if the tag is not owned by the buffer
+ */
+static inline WPTagInfo *
+lookup_tag_info(WPTextBufferPrivate * priv, GtkTextTag * tag)
+{
+    return (WPTagInfo *) g_hash_table_lookup(priv->tag_hash, tag);
+}
+
 static void
 wp_text_buffer_class_init(WPTextBufferClass * klass)
 {
@@ -666,6 +1016,18 @@ wp_text_buffer_class_init(WPTextBufferClass * klass)
                      G_STRUCT_OFFSET(WPTextBufferClass,
                                      refresh_attributes), NULL, NULL,
                      g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
+    /* Sent after refresh_attributes, when the attributes at the cursor
+     * has changed since the last emission. The parameters are a
+     * #WPTextBufferFormat, the same as returned by
+     * #wp_text_buffer_get_attributes, and a #WPTextBufferFormatChangeSet
+     * marking its changed fields. It has no class handler, so the class
+     * structure keeps its layout. */
+    signals[REFRESH_FORMAT] =
+        g_signal_new("refresh_format",
+                     G_OBJECT_CLASS_TYPE(object_class),
+                     G_SIGNAL_RUN_LAST, 0, NULL, NULL,
+                     g_cclosure_marshal_generic, G_TYPE_NONE, 2,
+                     G_TYPE_POINTER, G_TYPE_POINTER);
     signals[CAN_UNDO] =
         g_signal_new("can_undo", G_OBJECT_CLASS_TYPE(object_class),
                      G_SIGNAL_RUN_LAST, G_STRUCT_OFFSET(WPTextBufferClass,
@@ -720,6 +1082,16 @@ wp_text_buffer_class_init(WPTextBufferClass * klass)
                      G_SIGNAL_RUN_LAST, G_STRUCT_OFFSET(WPTextBufferClass,
                                                         no_memory), NULL,
                      NULL, g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
+    /* Sent when the list types of some lines has been changed without a
+     * text change, or when the buffer got its first or lost its last list
+     * item. The parameter is <b>TRUE</b> if the buffer has list items. It
+     * has no class handler, so the class structure keeps its layout. */
+    signals[LIST_CHANGED] =
+        g_signal_new("list_changed",
+                     G_OBJECT_CLASS_TYPE(object_class),
+                     G_SIGNAL_RUN_LAST, 0, NULL, NULL,
+                     g_cclosure_marshal_VOID__BOOLEAN, G_TYPE_NONE, 1,
+                     G_TYPE_BOOLEAN);
 }
 
 
@@ -753,6 +1125,11 @@ wp_text_buffer_init(WPTextBuffer * buffer)
     priv->is_empty = TRUE;
 
     priv->last_line_justification = GTK_JUSTIFY_LEFT;
+    priv->generation = 1;
+    /* A new buffer has a single empty line */
+    priv->paragraphs = g_array_new(FALSE, TRUE, sizeof(WPParagraph));
+    g_array_set_size(priv->paragraphs, 1);
+    priv->paragraph_change = -1;
 
     priv->undo = wp_undo_new(GTK_TEXT_BUFFER(buffer));
     priv->queue_undo_reset = FALSE;
@@ -767,10 +1144,7 @@ wp_text_buffer_init(WPTextBuffer * buffer)
     g_signal_connect(G_OBJECT(priv->undo), "no_memory",
                      G_CALLBACK(wp_text_buffer_no_memory_cb), buffer);
 
-    priv->color_tags =
-        color_buffer_create(GTK_TEXT_BUFFER(buffer), "foreground_gdk", 500);
     priv->parser = wp_html_parser_new(buffer);
-    priv->tag_hash = g_hash_table_new(NULL, NULL);
 }
 
 
@@ -801,12 +1175,15 @@ wp_text_buffer_finalize(GObject * object)
     WPTextBuffer *buffer = WP_TEXT_BUFFER(object);
     WPTextBufferPrivate *priv = buffer->priv;
 
-    g_free(priv->fonts);
     g_slist_free(priv->delete_tags);
+    g_array_free(priv->paragraphs, TRUE);
 
-    color_buffer_destroy(priv->color_tags);
+    if (priv->source_refresh_attributes)
+        g_source_remove(priv->source_refresh_attributes);
 
-    g_hash_table_destroy(priv->tag_hash);
+    if (priv->tag_set)
+        priv->tag_set->buffers =
+            g_slist_remove(priv->tag_set->buffers, buffer);
     g_object_unref(priv->undo);
 
     if (priv->background_color)
@@ -844,6 +1221,7 @@ wp_text_buffer_set_property(GObject * object,
             if (idx != priv->default_fmt.font)
             {
                 priv->default_fmt.font = idx;
+                priv->generation++;
                 if (priv->is_rich_text)
                     emit_default_font_changed(buffer);
             }
@@ -854,6 +1232,7 @@ wp_text_buffer_set_property(GObject * object,
             if (idx != priv->default_fmt.font_size)
             {
                 priv->default_fmt.font_size = idx;
+                priv->generation++;
                 if (priv->is_rich_text)
                     emit_default_font_changed(buffer);
             }
@@ -1013,7 +1392,9 @@ wp_text_buffer_end_user_action(GtkTextBuffer * text_buffer)
 
 
 /**
- * Update the selection in the <i>buffer</i> and store also in undo
+ * Update the selection in the <i>buffer</i> and store also in undo. In plain
+ * text the attributes are refreshed when the selection appears or
+ * disappears.
  * @param buffer is a #GtkTextBuffer
  */
 static void
@@ -1030,11 +1411,27 @@ wp_text_buffer_update_selection(WPTextBuffer * buffer)
     wp_undo_selection_changed(buffer->priv->undo, &start, &end);
 
     buffer->priv->has_selection = has_selection;
+    if (has_selection)
+        buffer->priv->select_closed = FALSE;
+    else if (!buffer->priv->select_closed)
+    {
+        wp_undo_close_select(buffer->priv->undo);
+        buffer->priv->select_closed = TRUE;
+    }
 
     if (old_selection != has_selection)
     {
         buffer->priv->last_cursor_pos = -1;
-        emit_refresh_attributes(buffer, NULL);
+        if (buffer->priv->is_rich_text)
+            emit_refresh_attributes(buffer, NULL);
+        else
+        {
+            /* Plain text is refreshed only here */
+            gtk_text_buffer_get_iter_at_mark(text_buffer, &start,
+                                             gtk_text_buffer_get_insert
+                                             (text_buffer));
+            emit_refresh_attributes(buffer, &start);
+        }
     }
 }
 
@@ -1049,11 +1446,33 @@ wp_text_buffer_mark_set(GtkTextBuffer * text_buffer,
 
     GtkTextMark *insert = gtk_text_buffer_get_insert(text_buffer);
     GtkTextMark *sel_bound = gtk_text_buffer_get_selection_bound(text_buffer);
+    GtkTextIter bound;
 
     if (GTK_TEXT_BUFFER_CLASS(wp_text_buffer_parent_class)->mark_set)
         GTK_TEXT_BUFFER_CLASS(wp_text_buffer_parent_class)->
             mark_set(text_buffer, iter, mark);
 
+    /* Plain text has the same attributes everywhere, they are refreshed
+     * only when the selection appears or disappears */
+    if (!buffer->priv->is_rich_text)
+    {
+        if (mark == insert || mark == sel_bound)
+            wp_text_buffer_update_selection(buffer);
+        return;
+    }
+
+    /* Moving the cursor without selection: only the refresh is scheduled */
+    if (mark == insert && !buffer->priv->has_selection &&
+        buffer->priv->select_closed)
+    {
+        gtk_text_buffer_get_iter_at_mark(text_buffer, &bound, sel_bound);
+        if (gtk_text_iter_equal(iter, &bound))
+        {
+            emit_refresh_attributes(buffer, iter);
+            return;
+        }
+    }
+
     if (mark == insert || mark == sel_bound)
         wp_text_buffer_update_selection(buffer);
 
@@ -1090,6 +1509,29 @@ find_justification_tag(GSList * head, gboolean free)
     return result;
 }
 
+/**
+ * Find the justification tag which starts or ends at <i>iter</i>, without
+ * building the tag lists
+ * @param priv is a pointer to #WPTextBufferPrivate
+ * @param iter a position in the buffer
+ * @param begin is <b>TRUE</b> to look for the tag starting at <i>iter</i>,
+ *              <b>FALSE</b> for the tag ending at <i>iter</i>
+ * @return the found justification tag or <b>NULL</b> if it not found
+ */
+static GtkTextTag *
+find_justification_toggle(WPTextBufferPrivate * priv,
+                          const GtkTextIter * iter, gboolean begin)
+{
+    gint i;
+
+    for (i = WPT_LEFT; i <= WPT_RIGHT; i++)
+        if (begin ? gtk_text_iter_begins_tag(iter, priv->tags[i]) :
+            gtk_text_iter_ends_tag(iter, priv->tags[i]))
+            return priv->tags[i];
+
+    return NULL;
+}
+
 static void
 wp_text_buffer_check_apply_tag(WPTextBuffer * buffer)
 {
@@ -1109,6 +1551,87 @@ wp_text_buffer_check_apply_tag(WPTextBuffer * buffer)
     }
 }
 
+/**
+ * Insert a single typed character inside a run of text. It is the common case
+ * of typing, where the new character simply inherits the tags around it, so
+ * there is no need to collect the tags to copy, to look for images or for
+ * the justification.
+ * @param buffer is a #WPTextBuffer
+ * @param pos a position in the buffer, moved after the inserted character
+ * @param text a valid UTF-8 character array
+ * @param length the length of <i>text</i> in bytes
+ * @return <b>TRUE</b> if the character has been inserted, <b>FALSE</b> if
+ *         the generic path has to be used
+ */
+static gboolean
+insert_char_fast(WPTextBuffer * buffer, GtkTextIter * pos,
+                 const gchar * text, gint length)
+{
+    WPTextBufferPrivate *priv = buffer->priv;
+    GtkTextBuffer *text_buffer = GTK_TEXT_BUFFER(buffer);
+
+    if (priv->delete_tags || priv->force_copy ||
+        !priv->insert_preserve_tags || !priv->is_rich_text ||
+        changeset_is_set(&priv->fmt.cs) ||
+        g_utf8_next_char(text) - text != length ||
+        g_utf8_get_char(text) == 0xFFFC || !wp_undo_is_enabled(priv->undo))
+        return FALSE;
+
+    /* Inside a run the tags are the same on both sides of the cursor. It
+     * holds also at the end of a line, when the line break has the tags of
+     * the last character. */
+    if (gtk_text_iter_starts_line(pos) ||
+        gtk_text_iter_toggles_tag(pos, NULL))
+        return FALSE;
+
+    wp_undo_insert_text(priv->undo, pos, text, length);
+
+    begin_paragraph_change(priv, gtk_text_iter_get_line(pos), FALSE);
+    GTK_TEXT_BUFFER_CLASS(wp_text_buffer_parent_class)->
+        insert_text(text_buffer, pos, text, length);
+    priv->generation++;
+    update_paragraphs(buffer);
+    priv->is_empty = FALSE;
+    priv->convert_tag = FALSE;
+
+    emit_refresh_attributes(buffer, pos);
+    return TRUE;
+}
+
+/**
+ * Insert text typed or pasted into a plain text buffer. Plain text has no
+ * tags, justification or images, so beside the undo only the paragraph
+ * table has to follow the change.
+ * @param buffer is a #WPTextBuffer
+ * @param pos a position in the buffer, moved after the inserted text
+ * @param text a valid UTF-8 character array
+ * @param length the length of <i>text</i> in bytes
+ * @return <b>TRUE</b> if the text has been inserted, <b>FALSE</b> if the
+ *         generic path has to be used
+ */
+static gboolean
+insert_text_plain(WPTextBuffer * buffer, GtkTextIter * pos,
+                  const gchar * text, gint length)
+{
+    WPTextBufferPrivate *priv = buffer->priv;
+
+    /* The undo replays go the generic way, they may restore rich text */
+    if (priv->is_rich_text || !wp_undo_is_enabled(priv->undo))
+        return FALSE;
+
+    wp_undo_insert_text(priv->undo, pos, text, length);
+
+    begin_paragraph_change(priv, gtk_text_iter_get_line(pos),
+                           gtk_text_iter_starts_line(pos));
+    GTK_TEXT_BUFFER_CLASS(wp_text_buffer_parent_class)->
+        insert_text(GTK_TEXT_BUFFER(buffer), pos, text, length);
+    priv->generation++;
+    update_paragraphs(buffer);
+    priv->is_empty = FALSE;
+    priv->convert_tag = FALSE;
+    return TRUE;
+}
+
 static void
 wp_text_buffer_insert_text(GtkTextBuffer * text_buffer,
                            GtkTextIter * pos, const gchar * text, gint length)
@@ -1122,23 +1645,33 @@ wp_text_buffer_insert_text(GtkTextBuffer * text_buffer,
     gboolean copy_tag;
     gchar pixbuf_str [6];
     gboolean has_image;
-    
-    pixbuf_str[g_unichar_to_utf8 (0xfffc, pixbuf_str)] = '\0';
-    has_image = (strstr (text, pixbuf_str) != NULL);
 
     if (!text[0])
         return;
 
     if (priv->fast_mode)
     {
+        begin_paragraph_change(priv, gtk_text_iter_get_line(pos),
+                               gtk_text_iter_starts_line(pos));
         GTK_TEXT_BUFFER_CLASS(wp_text_buffer_parent_class)->
             insert_text(text_buffer, pos, text, length);
         priv->is_empty = FALSE;
+        priv->generation++;
+        update_paragraphs(buffer);
         return;
     }
 
+    if (insert_text_plain(buffer, pos, text, length))
+        return;
+
     wp_text_buffer_check_apply_tag(buffer);
 
+    if (insert_char_fast(buffer, pos, text, length))
+        return;
+
+    pixbuf_str[g_unichar_to_utf8 (0xfffc, pixbuf_str)] = '\0';
+    has_image = (strstr (text, pixbuf_str) != NULL);
+
     wp_undo_insert_text(priv->undo, pos, text, length);
 
     priv->is_empty = FALSE;
@@ -1167,8 +1700,12 @@ wp_text_buffer_insert_text(GtkTextBuffer * text_buffer,
     }
     start_offset = gtk_text_iter_get_offset(pos);
 
+    begin_paragraph_change(priv, gtk_text_iter_get_line(pos),
+                           gtk_text_iter_starts_line(pos));
     GTK_TEXT_BUFFER_CLASS(wp_text_buffer_parent_class)->
         insert_text(text_buffer, pos, text, length);
+    priv->generation++;
+    update_paragraphs(buffer);
 
     start = *pos;
     gtk_text_iter_set_offset(&start, start_offset);
@@ -1200,7 +1737,8 @@ wp_text_buffer_insert_text(GtkTextBuffer * text_buffer,
         if (!priv->tmp_just)
         {
             priv->tmp_just =
-                find_justification_tag(gtk_text_iter_get_tags(pos), TRUE);
+                get_paragraph(buffer,
+                              gtk_text_iter_get_line(pos))->justification;
             if (priv->tmp_just)
             {
                 priv->just_start = start_offset;
@@ -1262,17 +1800,14 @@ _wp_text_buffer_adjust_justification(WPTextBuffer * buffer,
 {
     GtkTextTag *orig_tag, *tag;
     GtkTextIter *tmp = start ? start : end, pos;
+    gint line = gtk_text_iter_get_line(tmp);
 
-    orig_tag =
-        find_justification_tag(gtk_text_iter_get_toggled_tags
-                               (tmp, start != NULL), TRUE);
+    orig_tag = find_justification_toggle(buffer->priv, tmp, start != NULL);
     if (!orig_tag)
     {
         if (!def_tag && gtk_text_iter_is_end(tmp))
         {
-            tag =
-                find_justification_tag(gtk_text_iter_get_toggled_tags
-                                       (tmp, FALSE), TRUE);
+            tag = get_paragraph(buffer, line)->justification;
             if (tag)
                 emit_default_justification_changed(buffer,
                                                    tag->values->
@@ -1280,9 +1815,17 @@ _wp_text_buffer_adjust_justification(WPTextBuffer * buffer,
         }
         return;
     }
-    tag =
-        find_justification_tag(gtk_text_iter_get_toggled_tags(tmp, !start),
-                               TRUE);
+
+    /* The text after start takes the justification of its paragraph, which
+     * is the previous one if start begins the line */
+    if (!start)
+        tag = find_justification_toggle(buffer->priv, end, TRUE);
+    else if (!gtk_text_iter_starts_line(start))
+        tag = get_paragraph(buffer, line)->justification;
+    else
+        tag = line > 0 ? get_paragraph(buffer, line - 1)->justification : NULL;
+    if (tag == orig_tag)
+        tag = NULL;
     if (!tag && def_tag)
         tag = def_tag;
 
@@ -1306,6 +1849,86 @@ _wp_text_buffer_adjust_justification(WPTextBuffer * buffer,
     }
 }
 
+/**
+ * Delete a single character inside a line, the common case of backspace
+ * and delete. The character can't be an image or a line break, and the
+ * buffer doesn't become empty, so there is nothing to do with the images,
+ * justification or the remembered tags.
+ * @param buffer is a #WPTextBuffer
+ * @param start a position in the buffer
+ * @param end a position in the buffer
+ * @return <b>TRUE</b> if the character has been deleted, <b>FALSE</b> if
+ *         the generic path has to be used
+ */
+static gboolean
+delete_char_fast(WPTextBuffer * buffer, GtkTextIter * start,
+                 GtkTextIter * end)
+{
+    WPTextBufferPrivate *priv = buffer->priv;
+    GtkTextIter next = *start;
+    gunichar ch;
+
+    if (priv->has_selection || priv->remember_tag ||
+        !gtk_text_iter_forward_char(&next) || !gtk_text_iter_equal(&next, end))
+        return FALSE;
+
+    ch = gtk_text_iter_get_char(start);
+    if (ch == 0xFFFC || ch == '\n' || ch == '\r' ||
+        gtk_text_iter_is_end(end) || gtk_text_iter_ends_line(start))
+        return FALSE;
+
+    wp_undo_delete_range(priv->undo, start, end);
+
+    priv->convert_tag = FALSE;
+    begin_paragraph_change(priv, gtk_text_iter_get_line(start),
+                           gtk_text_iter_starts_line(start));
+    GTK_TEXT_BUFFER_CLASS(wp_text_buffer_parent_class)->
+        delete_range(GTK_TEXT_BUFFER(buffer), start, end);
+    priv->generation++;
+    update_paragraphs(buffer);
+
+    priv->last_cursor_pos = -1;
+    wp_text_buffer_update_selection(buffer);
+    emit_refresh_attributes(buffer, start);
+    return TRUE;
+}
+
+/**
+ * Delete a range of a plain text buffer, with the undo and the paragraph
+ * table as the only bookkeeping.
+ * @param buffer is a #WPTextBuffer
+ * @param start a position in the buffer
+ * @param end a position in the buffer
+ * @return <b>TRUE</b> if the range has been deleted, <b>FALSE</b> if the
+ *         generic path has to be used
+ */
+static gboolean
+delete_range_plain(WPTextBuffer * buffer, GtkTextIter * start,
+                   GtkTextIter * end)
+{
+    WPTextBufferPrivate *priv = buffer->priv;
+
+    if (priv->is_rich_text || !wp_undo_is_enabled(priv->undo))
+        return FALSE;
+
+    priv->is_empty = gtk_text_iter_is_start(start) &&
+        gtk_text_iter_is_end(end);
+
+    wp_undo_delete_range(priv->undo, start, end);
+
+    priv->convert_tag = FALSE;
+    begin_paragraph_change(priv, gtk_text_iter_get_line(start),
+                           gtk_text_iter_starts_line(start));
+    GTK_TEXT_BUFFER_CLASS(wp_text_buffer_parent_class)->
+        delete_range(GTK_TEXT_BUFFER(buffer), start, end);
+    priv->generation++;
+    update_paragraphs(buffer);
+
+    priv->last_cursor_pos = -1;
+    wp_text_buffer_update_selection(buffer);
+    return TRUE;
+}
+
 static void
 wp_text_buffer_delete_range(GtkTextBuffer * text_buffer,
                             GtkTextIter * start, GtkTextIter * end)
@@ -1315,17 +1938,21 @@ wp_text_buffer_delete_range(GtkTextBuffer * text_buffer,
     GtkTextTag *tag = NULL;
     gboolean undo, copy_tag, iter_end, different_line;
     gboolean has_image;
-    gchar pixbuf_char[6];
-
-    pixbuf_char[g_unichar_to_utf8 (0xfffc, pixbuf_char)] = 0;
 
     if (priv->fast_mode)
     {
+        begin_paragraph_change(priv, gtk_text_iter_get_line(start),
+                               gtk_text_iter_starts_line(start));
         GTK_TEXT_BUFFER_CLASS(wp_text_buffer_parent_class)->
             delete_range(text_buffer, start, end);
+        priv->generation++;
+        update_paragraphs(buffer);
         return;
     }
 
+    if (delete_range_plain(buffer, start, end))
+        return;
+
     wp_text_buffer_check_apply_tag(buffer);
 
     if (priv->delete_tags)
@@ -1334,9 +1961,12 @@ wp_text_buffer_delete_range(GtkTextBuffer * text_buffer,
         priv->delete_tags = NULL;
     }
 
+    if (delete_char_fast(buffer, start, end))
+        return;
+
     // printf("Delete range: %d-%d\n", gtk_text_iter_get_offset(start),
     // gtk_text_iter_get_offset(end));
-    has_image = gtk_text_iter_forward_search (start, pixbuf_char, 0, NULL, NULL, end);
+    has_image = range_has_image(buffer, start, end);
 
     undo = wp_undo_is_enabled(priv->undo);
     copy_tag = undo && priv->insert_preserve_tags;
@@ -1356,7 +1986,8 @@ wp_text_buffer_delete_range(GtkTextBuffer * text_buffer,
     if (!priv->is_empty && copy_tag)
     {
         if (iter_end || different_line)
-            tag = find_justification_tag(gtk_text_iter_get_tags(start), TRUE);
+            tag = get_paragraph(buffer,
+                                gtk_text_iter_get_line(start))->justification;
 
         if (priv->has_selection || priv->remember_tag)
         {
@@ -1371,22 +2002,17 @@ wp_text_buffer_delete_range(GtkTextBuffer * text_buffer,
                                                tag->values->justification);
     }
 
-    /* Don't know why, but if is a large portion to delete, and the interval
-     * contains several tag toggles, it takes eternity for the textbuffer to 
-     * delete. So we add a little hack, first clear the tags */
-
-    if (abs(gtk_text_iter_get_offset(end) - gtk_text_iter_get_offset(start)) >
-        100)
-    {
-        if (undo)
-            wp_undo_freeze(priv->undo);
-        gtk_text_buffer_remove_all_tags(text_buffer, start, end);
-        if (undo)
-            wp_undo_thaw(priv->undo);
-    }
+    /* Deleting an interval with lot of tag toggles is slow, the B-tree
+     * drops the toggles one by one. So first clear the tags, every tag at
+     * once over the whole interval. The undo already saved them. */
+    clear_range_tags(buffer, start, end);
 
+    begin_paragraph_change(priv, gtk_text_iter_get_line(start),
+                           gtk_text_iter_starts_line(start));
     GTK_TEXT_BUFFER_CLASS(wp_text_buffer_parent_class)->
         delete_range(text_buffer, start, end);
+    priv->generation++;
+    update_paragraphs(buffer);
 
     if (!priv->is_empty)
     {
@@ -1421,6 +2047,9 @@ _apply_tag(WPTextBufferPrivate * priv,
            GtkTextTag * tag,
            const GtkTextIter * start, const GtkTextIter * end)
 {
+    if (tag == NULL)
+        return;
+
     if (!priv->fast_mode)
     {
         wp_undo_apply_tag(priv->undo, start, end, tag, TRUE);
@@ -1429,6 +2058,8 @@ _apply_tag(WPTextBufferPrivate * priv,
     GTK_TEXT_BUFFER_CLASS(wp_text_buffer_parent_class)->apply_tag(buffer,
                                                                   tag,
                                                                   start, end);
+    priv->generation++;
+    invalidate_paragraphs(priv, tag, start, end);
     /* printf("Apply tag: %s, %d-%d\n", tag->name ? tag->name : "(null)",
      * gtk_text_iter_get_offset(start), gtk_text_iter_get_offset(end)); */
 }
@@ -1466,102 +2097,97 @@ wp_text_buffer_apply_tag(GtkTextBuffer * buffer,
         // printf("=== Convert tag: %s ===\n", tag->name);
         if (!g_hash_table_lookup(priv->tag_hash, tag))
         {
-            if (tag->name && strncmp(tag->name, "wp-text-bullet", 14) == 0)
-                _apply_tag(priv, buffer, priv->tags[WPT_BULLET], start, end);
-            else
+            if (tag->values->font)
             {
-                if (tag->values->font)
+                gint size;
+                const gchar *name;
+                PangoFontDescription *font = tag->values->font;
+                if (pango_font_description_get_style(font))
+                    _apply_tag(priv, buffer, priv->tags[WPT_ITALIC],
+                               start, end);
+                if (pango_font_description_get_weight(font) !=
+                    PANGO_WEIGHT_NORMAL)
+                    _apply_tag(priv, buffer, priv->tags[WPT_BOLD], start,
+                               end);
+                if ((size = pango_font_description_get_size(font)))
                 {
-                    gint size;
-                    const gchar *name;
-                    PangoFontDescription *font = tag->values->font;
-                    if (pango_font_description_get_style(font))
-                        _apply_tag(priv, buffer, priv->tags[WPT_ITALIC],
-                                   start, end);
-                    if (pango_font_description_get_weight(font) !=
-                        PANGO_WEIGHT_NORMAL)
-                        _apply_tag(priv, buffer, priv->tags[WPT_BOLD], start,
-                                   end);
-                    if ((size = pango_font_description_get_size(font)))
+                    if (tag->name
+                        && strncmp(tag->name, "wp-text-", 8) == 0)
                     {
-                        if (tag->name
-                            && strncmp(tag->name, "wp-text-", 8) == 0)
-                        {
-                            gchar no[2], *p;
-                            no[1] = 0;
-                            p = strrchr(tag->name, '-');
-                            if (*(p - 1) >= '0' && *(p - 1) <= '9')
-                                no[0] = *(p - 1);
-                            else
-                                no[0] = *(p + 1);
-                            // printf("Text size: %s\n", no);
-                            size = atoi(no);
-                            if (tag->values->appearance.rise == 0)
-                                _apply_tag(priv, buffer,
-                                           priv->font_size_tags[size], start,
-                                           end);
-                            else if (tag->values->appearance.rise < 0)
-                                _apply_tag(priv, buffer,
-                                           priv->font_size_sub_tags[size],
-                                           start, end);
-                            else
-                                _apply_tag(priv, buffer,
-                                           priv->font_size_sup_tags[size],
-                                           start, end);
-                        }
+                        gchar no[2], *p;
+                        TextPosition position;
+                        no[1] = 0;
+                        p = strrchr(tag->name, '-');
+                        if (*(p - 1) >= '0' && *(p - 1) <= '9')
+                            no[0] = *(p - 1);
                         else
-                        {
-                            size =
-                                wp_get_font_size_index(iround
-                                                       (size /
-                                                        priv->
-                                                        font_scaling_factor /
-                                                        PANGO_SCALE),
-                                                       priv->default_fmt.
-                                                       font_size);
-                            _apply_tag(priv, buffer,
-                                       priv->font_size_tags[size], start,
-                                       end);
-                        }
+                            no[0] = *(p + 1);
+                        // printf("Text size: %s\n", no);
+                        size = atoi(no);
+                        if (tag->values->appearance.rise == 0)
+                            position = TEXT_POSITION_NORMAL;
+                        else if (tag->values->appearance.rise < 0)
+                            position = TEXT_POSITION_SUBSCRIPT;
+                        else
+                            position = TEXT_POSITION_SUPERSCRIPT;
+                        _apply_tag(priv, buffer,
+                                   get_position_tag(priv, position,
+                                                    size), start, end);
                     }
-                    if ((name = pango_font_description_get_family(font)))
+                    else
                     {
-                        gint idx =
-                            wp_get_font_index(name, priv->default_fmt.font);
-                        _apply_tag(priv, buffer, priv->fonts[idx], start,
-                                   end);
+                        size =
+                            wp_get_font_size_index(iround
+                                                   (size /
+                                                    priv->
+                                                    font_scaling_factor /
+                                                    PANGO_SCALE),
+                                                   priv->default_fmt.
+                                                   font_size);
+                        _apply_tag(priv, buffer,
+                                   get_format_tag(priv,
+                                                  WPT_CAT_FONT_SIZE,
+                                                  size), start, end);
                     }
                 }
-                if (tag->underline_set)
-                    _apply_tag(priv, buffer, priv->tags[WPT_UNDERLINE], start,
-                               end);
-                if (tag->strikethrough_set)
-                    _apply_tag(priv, buffer, priv->tags[WPT_STRIKE], start,
-                               end);
-                if (tag->justification_set)
-                {
-                    if (tag->values->justification == GTK_JUSTIFY_LEFT)
-                        _apply_tag(priv, buffer, priv->tags[WPT_LEFT], start,
-                                   end);
-                    else if (tag->values->justification == GTK_JUSTIFY_CENTER)
-                        _apply_tag(priv, buffer, priv->tags[WPT_CENTER],
-                                   start, end);
-                    else
-                        _apply_tag(priv, buffer, priv->tags[WPT_RIGHT], start,
-                                   end);
-                }
-                if (tag->fg_color_set)
+                if ((name = pango_font_description_get_family(font)))
                 {
-                    GtkTextTag *t = color_buffer_get_tag(priv->color_tags,
-                                                         &tag->values->
-                                                         appearance.fg_color,
-                                                         priv->
-                                                         tags[WPT_RIGHT]->
-                                                         priority + 1);
-                    _apply_tag(priv, buffer, t, start, end);
-                    g_hash_table_insert(priv->tag_hash, t, NULL);
+                    gint idx =
+                        wp_get_font_index(name, priv->default_fmt.font);
+                    _apply_tag(priv, buffer,
+                               get_format_tag(priv, WPT_CAT_FONT, idx),
+                               start, end);
                 }
             }
+            if (tag->underline_set)
+                _apply_tag(priv, buffer, priv->tags[WPT_UNDERLINE], start,
+                           end);
+            if (tag->strikethrough_set)
+                _apply_tag(priv, buffer, priv->tags[WPT_STRIKE], start,
+                           end);
+            if (tag->justification_set)
+            {
+                if (tag->values->justification == GTK_JUSTIFY_LEFT)
+                    _apply_tag(priv, buffer, priv->tags[WPT_LEFT], start,
+                               end);
+                else if (tag->values->justification == GTK_JUSTIFY_CENTER)
+                    _apply_tag(priv, buffer, priv->tags[WPT_CENTER],
+                               start, end);
+                else
+                    _apply_tag(priv, buffer, priv->tags[WPT_RIGHT], start,
+                               end);
+            }
+            if (tag->fg_color_set)
+            {
+                GtkTextTag *t = color_buffer_get_tag(priv->color_tags,
+                                                     &tag->values->
+                                                     appearance.fg_color,
+                                                     priv->
+                                                     tags[WPT_RIGHT]->
+                                                     priority + 1);
+                register_tag(priv, t, WPT_CAT_COLOR, 0);
+                _apply_tag(priv, buffer, t, start, end);
+            }
             tag = NULL;
         }
     }
@@ -1601,6 +2227,8 @@ wp_text_buffer_remove_tag(GtkTextBuffer * buffer,
                                                                    tag,
                                                                    start,
                                                                    end);
+    priv->generation++;
+    invalidate_paragraphs(priv, tag, start, end);
 
     /* printf("Remove tag: %s, %d-%d, %d\n", tag->name ? tag->name :
      * "(null)", gtk_text_iter_get_offset(start),
@@ -1637,21 +2265,109 @@ emit_background_color_change(WPTextBuffer * buffer)
 }
 
 /**
- * Callback from timeout, to send the refresh_attributes signal
+ * Callback from timeout, to send the refresh_attributes signal. If the
+ * deadline has been moved since the timeout was added, the timeout is added
+ * again for the remaining time.
  * @param data is a #GtkTextBuffer
  */
 static gboolean
 idle_emit_refresh_attributes(gpointer data)
 {
+    WPTextBufferPrivate *priv;
+    gint64 remaining;
+
     if ((data) && WP_IS_TEXT_BUFFER(data))
     {
-        WP_TEXT_BUFFER(data)->priv->source_refresh_attributes = 0;
+        priv = WP_TEXT_BUFFER(data)->priv;
+        remaining = (priv->refresh_deadline - g_get_monotonic_time()) / 1000;
+        if (remaining > 0)
+        {
+            priv->source_refresh_attributes =
+                g_timeout_add_full(G_PRIORITY_DEFAULT, remaining,
+                                   idle_emit_refresh_attributes, data, NULL);
+            return FALSE;
+        }
+
+        priv->source_refresh_attributes = 0;
 
-        g_signal_emit(data, signals[REFRESH_ATTRIBUTES], 0);
+        emit_refresh_signals(WP_TEXT_BUFFER(data));
     }
     return FALSE;
 }
 
+/**
+ * Collect the fields which differ between <i>old</i> and <i>fmt</i>
+ * @param old is a #WPTextBufferFormat
+ * @param fmt is a #WPTextBufferFormat
+ * @param changed is a #WPTextBufferFormatChangeSet which is set for every
+ *                field which differs
+ * @return <b>TRUE</b> if there is at least one difference
+ */
+static gboolean
+format_diff(const WPTextBufferFormat * old, const WPTextBufferFormat * fmt,
+            WPTextBufferFormatChangeSet * changed)
+{
+    changed->bold = !old->bold != !fmt->bold;
+    changed->italic = !old->italic != !fmt->italic;
+    changed->underline = !old->underline != !fmt->underline;
+    changed->strikethrough = !old->strikethrough != !fmt->strikethrough;
+    changed->bullet = !old->bullet != !fmt->bullet;
+    changed->justification = old->justification != fmt->justification;
+    changed->text_position = old->text_position != fmt->text_position;
+    changed->color = old->color.red != fmt->color.red ||
+        old->color.green != fmt->color.green ||
+        old->color.blue != fmt->color.blue;
+    changed->font = old->font != fmt->font;
+    changed->font_size = old->font_size != fmt->font_size;
+
+    return changeset_is_set(changed);
+}
+
+static void
+emit_refresh_signals(WPTextBuffer * buffer)
+{
+    WPTextBufferPrivate *priv = buffer->priv;
+    WPTextBufferFormatChangeSet changed;
+    WPTextBufferFormat fmt;
+
+    g_signal_emit(buffer, signals[REFRESH_ATTRIBUTES], 0);
+
+    if (!g_signal_has_handler_pending(buffer, signals[REFRESH_FORMAT], 0,
+                                      FALSE))
+        return;
+
+    wp_text_buffer_get_attributes(buffer, &fmt, FALSE);
+    if (!priv->refresh_fmt_valid)
+        memset(&changed, 0xff, sizeof(changed));
+    else if (!format_diff(&priv->refresh_fmt, &fmt, &changed))
+        return;
+
+    priv->refresh_fmt = fmt;
+    priv->refresh_fmt_valid = TRUE;
+    g_signal_emit(buffer, signals[REFRESH_FORMAT], 0, &fmt, &changed);
+}
+
+/**
+ * Schedule the refresh_attributes signal after #REFRESH_ATTRIBUTES_DELAY.
+ * A pending timeout is kept, only it's deadline is moved, so there is
+ * no new timeout source at every keystroke. The timeout runs with idle
+ * priority, after the redraw of the view.
+ * @param buffer is a #WPTextBuffer
+ */
+static void
+schedule_refresh_attributes(WPTextBuffer * buffer)
+{
+    WPTextBufferPrivate *priv = buffer->priv;
+
+    priv->refresh_deadline =
+        g_get_monotonic_time() + REFRESH_ATTRIBUTES_DELAY * 1000;
+    if (!priv->source_refresh_attributes)
+        priv->source_refresh_attributes =
+            g_timeout_add_full(G_PRIORITY_DEFAULT,
+                               REFRESH_ATTRIBUTES_DELAY,
+                               idle_emit_refresh_attributes, buffer, NULL);
+}
+
 static void
 emit_refresh_attributes(WPTextBuffer * buffer, const GtkTextIter * where)
 {
@@ -1674,11 +2390,7 @@ emit_refresh_attributes(WPTextBuffer * buffer, const GtkTextIter * where)
                 && !gtk_text_iter_is_end(where))
                 changeset_clear(&buffer->priv->fmt.cs);
 
-            if (buffer->priv->source_refresh_attributes)
-                g_source_remove(buffer->priv->source_refresh_attributes);
-
-            buffer->priv->source_refresh_attributes =
-                g_timeout_add(400, idle_emit_refresh_attributes, buffer);
+            schedule_refresh_attributes(buffer);
         }
     }
     else
@@ -1710,157 +2422,327 @@ thaw_cursor_moved(WPTextBuffer * buffer)
 
 
 /**
- * Check if a <i>tag</i> is a tag from the <i>base</i>, and find the
- * difference number between the <i>tag</i>'s id and the base. It is used
- * to retrieve the font size from a font tag
+ * Check if a <i>tag</i> is a tag from the <i>category</i>, and find the
+ * index of the <i>tag</i> inside the category. It is used to retrieve the
+ * font size or the font from a tag
+ * @param priv is a pointer to #WPTextBufferPrivate
  * @param tag is a #GtkTextTag
- * @param base is a number identifying the base (#WPT_FONT_SIZE, #WPT_SUP_SRPT, 
- *              #WPT_SUB_SRPT, #WPT_FONT)
- * @param nr pointer to a number which will hold the difference
- * @return <b>TRUE</b> if the <i>tag</i> is of type <i>base</i>
+ * @param category is one of #WPT_CAT_FONT_SIZE, #WPT_CAT_SUP_SRPT,
+ *              #WPT_CAT_SUB_SRPT, #WPT_CAT_FONT
+ * @param nr pointer to a number which will hold the index
+ * @return <b>TRUE</b> if the <i>tag</i> is of type <i>category</i>
  */
 static gboolean
-check_tag_type(GtkTextTag * tag, gint base, gint * nr)
+check_tag_type(WPTextBufferPrivate * priv, GtkTextTag * tag,
+               WPTagCategory category, gint * nr)
 {
-    gint val = GPOINTER_TO_INT (g_object_get_data(G_OBJECT(tag), WPT_ID));
-    gboolean result = val >= base && val <= base + 999;
+    WPTagInfo *info = lookup_tag_info(priv, tag);
+    gboolean result = info && info->category == category;
     if (result && nr)
-        *nr = val - base;
+        *nr = info->index;
     return result;
 }
 
 /**
  * Check if a <i>tag</i> is modifying the font size
+ * @param priv is a pointer to #WPTextBufferPrivate
  * @param tag is a #GtkTextTag
  * @return <b>TRUE</b> if the <i>tag</i> is modifying the size
  */
 static gboolean
-check_tag_fontsize_type(GtkTextTag * tag)
+check_tag_fontsize_type(WPTextBufferPrivate * priv, GtkTextTag * tag)
+{
+    WPTagInfo *info = lookup_tag_info(priv, tag);
+    return info && (info->category == WPT_CAT_FONT_SIZE ||
+                    info->category == WPT_CAT_SUP_SRPT ||
+                    info->category == WPT_CAT_SUB_SRPT);
+}
+
+/**
+ * Free a #WPTagSet, called when it's tag table is destroyed. The tags are
+ * owned by the tag table.
+ * @param data pointer to a #WPTagSet
+ */
+static void
+tag_set_free(gpointer data)
+{
+    WPTagSet *set = (WPTagSet *) data;
+
+    g_free(set->fonts);
+    g_slist_free(set->buffers);
+    color_buffer_destroy(set->color_tags);
+    g_hash_table_destroy(set->tag_hash);
+    g_hash_table_destroy(set->images);
+    g_free(set);
+}
+
+/**
+ * Make the buffer use the tags from the tag <i>set</i>
+ * @param priv is a pointer to #WPTextBufferPrivate
+ * @param set is a #WPTagSet
+ */
+static void
+use_tag_set(WPTextBufferPrivate * priv, WPTagSet * set)
+{
+    priv->tag_set = set;
+    priv->tags = set->tags;
+    priv->color_tags = set->color_tags;
+    priv->font_size_tags = set->font_size_tags;
+    priv->font_size_sup_tags = set->font_size_sup_tags;
+    priv->font_size_sub_tags = set->font_size_sub_tags;
+    priv->tag_hash = set->tag_hash;
+}
+
+static GtkTextTag *
+get_format_tag(WPTextBufferPrivate * priv, WPTagCategory category,
+               gint index)
+{
+    WPTagSet *set = priv->tag_set;
+    GtkTextTag **slot;
+    gchar *name;
+
+    switch (category)
+    {
+        case WPT_CAT_FONT_SIZE:
+            slot = &set->font_size_tags[index];
+            break;
+        case WPT_CAT_SUP_SRPT:
+            slot = &set->font_size_sup_tags[index];
+            break;
+        case WPT_CAT_SUB_SRPT:
+            slot = &set->font_size_sub_tags[index];
+            break;
+        default:
+            g_return_val_if_fail(index >= 0 && index < wp_get_font_count(),
+                                 NULL);
+
+            /* The font list can be reloaded with more fonts */
+            if (index >= set->n_fonts)
+            {
+                set->fonts = g_renew(GtkTextTag *, set->fonts,
+                                     wp_get_font_count());
+                memset(set->fonts + set->n_fonts, 0,
+                       (wp_get_font_count() - set->n_fonts) *
+                       sizeof(GtkTextTag *));
+                set->n_fonts = wp_get_font_count();
+            }
+            slot = &set->fonts[index];
+    }
+
+    if (*slot)
+        return *slot;
+
+    if (category == WPT_CAT_FONT)
+    {
+        name = g_strdup_printf("wp-text-font-%s", wp_get_font_name(index));
+        *slot = gtk_text_tag_new(name);
+        g_object_set(G_OBJECT(*slot), "family", wp_get_font_name(index),
+                     NULL);
+    }
+    else
+    {
+        name = g_strdup_printf(category == WPT_CAT_FONT_SIZE ?
+                               "wp-text-font-size-%d" :
+                               category == WPT_CAT_SUP_SRPT ?
+                               "wp-text-sup-%d" : "wp-text-sub-%d", index);
+        *slot = gtk_text_tag_new(name);
+        set_size_tag_attributes(*slot, category, index,
+                                get_size_table(set,
+                                               priv->font_scaling_factor));
+    }
+    g_free(name);
+
+    gtk_text_tag_table_add(set->table, *slot);
+    g_object_unref(*slot);
+
+    register_tag(priv, *slot, category, index);
+
+    return *slot;
+}
+
+/**
+ * Add the tags which are in use by the <i>buffer</i>, apart from the text,
+ * to the <i>used</i> hash table: the tags referenced by the undo records and
+ * the tags remembered for the next insert.
+ * @param buffer is a #WPTextBuffer
+ * @param used is a #GHashTable
+ */
+static void
+collect_referenced_tags(WPTextBuffer * buffer, GHashTable * used)
+{
+    GSList *tmp;
+
+    wp_undo_collect_tags(buffer->priv->undo, used);
+
+    for (tmp = buffer->priv->delete_tags; tmp; tmp = tmp->next)
+        g_hash_table_insert(used, tmp->data, tmp->data);
+    for (tmp = buffer->priv->copy_insert_tags; tmp; tmp = tmp->next)
+        g_hash_table_insert(used, tmp->data, tmp->data);
+}
+
+/**
+ * Check if the <i>tag</i> is applied somewhere in the <i>buffer</i>
+ * @param buffer is a #GtkTextBuffer
+ * @param tag is a #GtkTextTag
+ * @return <b>TRUE</b> if the tag has a toggle in the buffer
+ */
+static gboolean
+tag_is_applied(GtkTextBuffer * buffer, GtkTextTag * tag)
+{
+    GtkTextIter iter;
+
+    gtk_text_buffer_get_start_iter(buffer, &iter);
+    return gtk_text_iter_begins_tag(&iter, tag) ||
+        gtk_text_iter_forward_to_tag_toggle(&iter, tag);
+}
+
+/**
+ * Remove a tag from the lookup tables of the tag <i>set</i>, so it will be
+ * created again at it's next use.
+ * @param set is a #WPTagSet
+ * @param tag is a #GtkTextTag
+ * @param info is the #WPTagInfo of the <i>tag</i>
+ */
+static void
+forget_tag(WPTagSet * set, GtkTextTag * tag, WPTagInfo * info)
 {
-    gint val = GPOINTER_TO_INT (g_object_get_data(G_OBJECT(tag), WPT_ID));
-    return (val >= WPT_FONT_SIZE && val <= WPT_FONT_SIZE + 999) ||
-        (val >= WPT_SUB_SRPT && val <= WPT_SUB_SRPT + 999) ||
-        (val >= WPT_SUP_SRPT && val <= WPT_SUP_SRPT + 999);
+    WPImageEntry *entry;
+
+    switch (info->category)
+    {
+        case WPT_CAT_FONT_SIZE:
+            set->font_size_tags[info->index] = NULL;
+            break;
+        case WPT_CAT_SUP_SRPT:
+            set->font_size_sup_tags[info->index] = NULL;
+            break;
+        case WPT_CAT_SUB_SRPT:
+            set->font_size_sub_tags[info->index] = NULL;
+            break;
+        case WPT_CAT_FONT:
+            set->fonts[info->index] = NULL;
+            break;
+        case WPT_CAT_COLOR:
+            color_buffer_remove(set->color_tags,
+                                &tag->values->appearance.fg_color);
+            break;
+        case WPT_CAT_IMAGE:
+            entry = g_hash_table_lookup(set->images, info->image_id);
+            if (entry && info->index)
+                entry->replace_tag = NULL;
+            else if (entry)
+                entry->tag = NULL;
+            break;
+    }
 }
 
-#define HILDON_BASE_COLOR_NUM 15
+void
+wp_text_buffer_collect_tags(WPTextBuffer * buffer)
+{
+    WPTagSet *set;
+    GHashTable *used;
+    GHashTableIter iter;
+    GtkTextTag *tag;
+    WPTagInfo *info;
+    gpointer key, value;
+    GSList *tmp;
+
+    g_return_if_fail(WP_IS_TEXT_BUFFER(buffer));
+
+    set = buffer->priv->tag_set;
+    used = g_hash_table_new(NULL, NULL);
+    for (tmp = set->buffers; tmp; tmp = tmp->next)
+        collect_referenced_tags(WP_TEXT_BUFFER(tmp->data), used);
+
+    g_hash_table_iter_init(&iter, set->tag_hash);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        tag = GTK_TEXT_TAG(key);
+        info = (WPTagInfo *) value;
+
+        if (!info->dynamic || g_hash_table_lookup(used, tag))
+            continue;
+
+        for (tmp = set->buffers; tmp; tmp = tmp->next)
+            if (tag_is_applied(GTK_TEXT_BUFFER(tmp->data), tag))
+                break;
+        if (tmp)
+            continue;
+
+        forget_tag(set, tag, info);
+        g_hash_table_iter_remove(&iter);
+        gtk_text_tag_table_remove(set->table, tag);
+    }
+
+    g_hash_table_destroy(used);
+}
 
 static void
 wp_text_buffer_init_tags(WPTextBuffer * buffer)
 {
-    int i;
     GtkTextBuffer *b = GTK_TEXT_BUFFER(buffer);
-    gchar *tmp;
     WPTextBufferPrivate *priv = buffer->priv;
-    static char *base_colours[HILDON_BASE_COLOR_NUM] = {
-        "#FFFFFF", "#FF0000", "#660000", "#0000FF", "#000066",
-        "#FF33FF", "#660066", "#33CC33", "#006600", "#FFCC00",
-        "#CC9900", "#999999", "#666666", "#00CCCC", "#006666"
-    };
-    GdkColor color = { 0 };
+    GtkTextTagTable *table = gtk_text_buffer_get_tag_table(b);
+    WPTagSet *set;
+
+    /* The tags are created only by the first buffer of the tag table */
+    set = g_object_get_data(G_OBJECT(table), "wp-tag-set");
+    if (set)
+    {
+        use_tag_set(priv, set);
+        set->buffers = g_slist_prepend(set->buffers, buffer);
+        return;
+    }
+
+    set = g_new0(WPTagSet, 1);
+    set->color_tags = color_buffer_create(table, "foreground_gdk");
+    set->tag_hash = g_hash_table_new_full(NULL, NULL, NULL, tag_info_free);
+    set->images = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                        g_free);
+    set->table = table;
+    g_object_set_data_full(G_OBJECT(table), "wp-tag-set", set, tag_set_free);
+    use_tag_set(priv, set);
+    set->buffers = g_slist_prepend(set->buffers, buffer);
 
     priv->tags[WPT_BOLD] =
         gtk_text_buffer_create_tag(b, tagnames[WPT_BOLD], "weight",
                                    PANGO_WEIGHT_BOLD, NULL);
-    g_hash_table_insert(priv->tag_hash, priv->tags[WPT_BOLD], NULL);
+    register_tag(priv, priv->tags[WPT_BOLD], WPT_CAT_SIMPLE, WPT_BOLD);
     priv->tags[WPT_ITALIC] =
         gtk_text_buffer_create_tag(b, tagnames[WPT_ITALIC], "style",
                                    PANGO_STYLE_ITALIC, NULL);
-    g_hash_table_insert(priv->tag_hash, priv->tags[WPT_ITALIC], NULL);
+    register_tag(priv, priv->tags[WPT_ITALIC], WPT_CAT_SIMPLE, WPT_ITALIC);
     priv->tags[WPT_UNDERLINE] =
         gtk_text_buffer_create_tag(b, tagnames[WPT_UNDERLINE], "underline",
                                    PANGO_UNDERLINE_SINGLE, NULL);
-    g_hash_table_insert(priv->tag_hash, priv->tags[WPT_UNDERLINE], NULL);
+    register_tag(priv, priv->tags[WPT_UNDERLINE], WPT_CAT_SIMPLE, WPT_UNDERLINE);
 
     priv->tags[WPT_STRIKE] =
         gtk_text_buffer_create_tag(b, tagnames[WPT_STRIKE],
                                    "strikethrough", TRUE, NULL);
-    g_hash_table_insert(priv->tag_hash, priv->tags[WPT_STRIKE], NULL);
+    register_tag(priv, priv->tags[WPT_STRIKE], WPT_CAT_SIMPLE, WPT_STRIKE);
 
     priv->tags[WPT_LEFT] =
         gtk_text_buffer_create_tag(b, tagnames[WPT_LEFT],
                                    "justification", GTK_JUSTIFY_LEFT, NULL);
-    g_hash_table_insert(priv->tag_hash, priv->tags[WPT_LEFT], NULL);
+    register_tag(priv, priv->tags[WPT_LEFT], WPT_CAT_SIMPLE, WPT_LEFT);
 
     priv->tags[WPT_CENTER] =
         gtk_text_buffer_create_tag(b, tagnames[WPT_CENTER],
                                    "justification", GTK_JUSTIFY_CENTER, NULL);
-    g_hash_table_insert(priv->tag_hash, priv->tags[WPT_CENTER], NULL);
+    register_tag(priv, priv->tags[WPT_CENTER], WPT_CAT_SIMPLE, WPT_CENTER);
 
     priv->tags[WPT_RIGHT] =
         gtk_text_buffer_create_tag(b, tagnames[WPT_RIGHT],
                                    "justification", GTK_JUSTIFY_RIGHT, NULL);
-    g_hash_table_insert(priv->tag_hash, priv->tags[WPT_RIGHT], NULL);
-
-    for (i = 0; i < WP_FONT_SIZE_COUNT; i++)
-    {
-        /* Normal size */
-        tmp = g_strdup_printf("wp-text-font-size-%d", i);
-        priv->font_size_tags[i] = gtk_text_buffer_create_tag(b, tmp, NULL);
-        g_object_set_data(G_OBJECT(priv->font_size_tags[i]), WPT_ID,
-                          GINT_TO_POINTER(WPT_FONT_SIZE + i));
-        g_free(tmp);
-        g_hash_table_insert(priv->tag_hash, priv->font_size_tags[i], NULL);
-
-        /* Superscript size */
-        tmp = g_strdup_printf("wp-text-sup-%d", i);
-        priv->font_size_sup_tags[i] =
-            gtk_text_buffer_create_tag(b, tmp, NULL);
-        g_object_set_data(G_OBJECT(priv->font_size_sup_tags[i]), WPT_ID,
-                          GINT_TO_POINTER(WPT_SUP_SRPT + i));
-        g_free(tmp);
-        g_hash_table_insert(priv->tag_hash, priv->font_size_sup_tags[i],
-                            NULL);
-
-        /* Subscript size */
-        tmp = g_strdup_printf("wp-text-sub-%d", i);
-        priv->font_size_sub_tags[i] =
-            gtk_text_buffer_create_tag(b, tmp, NULL);
-        g_object_set_data(G_OBJECT(priv->font_size_sub_tags[i]), WPT_ID,
-                          GINT_TO_POINTER(WPT_SUB_SRPT + i));
-        g_free(tmp);
-        g_hash_table_insert(priv->tag_hash, priv->font_size_sub_tags[i],
-                            NULL);
-    }
-
-    wp_text_buffer_resize_font(buffer);
-
-    /* Create font tags from all available fonts */
-
-    priv->fonts = g_new(GtkTextTag *, wp_get_font_count());
-    for (i = 0; i < wp_get_font_count(); i++)
-    {
-        tmp = g_strdup_printf("wp-text-font-%s", wp_get_font_name(i));
-        priv->fonts[i] = gtk_text_buffer_create_tag(b, tmp,
-                                                    "family",
-                                                    wp_get_font_name(i),
-                                                    NULL);
-        g_free(tmp);
-        g_object_set_data(G_OBJECT(priv->fonts[i]), WPT_ID,
-                          GINT_TO_POINTER(WPT_FONT + i));
-        g_hash_table_insert(priv->tag_hash, priv->fonts, NULL);
-        // printf("Ordered font: %s\n", priv->font_name_list[i]);
-    }
+    register_tag(priv, priv->tags[WPT_RIGHT], WPT_CAT_SIMPLE, WPT_RIGHT);
 
-    // Create the bullet last to have the highest priority
-    priv->tags[WPT_BULLET] =
-        gtk_text_buffer_create_tag(b, tagnames[WPT_BULLET],
-                                   "weight", PANGO_WEIGHT_NORMAL,
-                                   "style", PANGO_STYLE_NORMAL,
-                                   "underline", PANGO_UNDERLINE_NONE,
-                                   "font", "fixed",
-                                   "strikethrough", FALSE, "indent", 8, NULL);
-    g_hash_table_insert(priv->tag_hash, priv->tags[WPT_BULLET], NULL);
-
-    for (i = 0; i < HILDON_BASE_COLOR_NUM; i++)
-    {
-        gdk_color_parse(base_colours[i], &color);
-        g_hash_table_insert(priv->tag_hash,
-                            color_buffer_get_tag(priv->color_tags, &color,
-                                                 priv->tags[WPT_RIGHT]->
-                                                 priority + 1), NULL);
-    }
+    /* The size, font and color tags are created at their first use. The
+     * bullets and the list numbers have no tag, they are kept in the
+     * paragraph table of the buffer. */
 
+    set->image_tag = gtk_text_buffer_create_tag(b, "wp-image", NULL);
+    register_tag(priv, set->image_tag, WPT_CAT_IMAGE, 2)->dynamic = FALSE;
 }
 
 
@@ -1907,16 +2789,10 @@ wp_text_buffer_copy_tag_attributes(WPTextBuffer * buffer,
                 (tag->justification_set && !cs.justification) ||
                 (tag->fg_color_set && !cs.color) ||
                 (!cs.font && tag->values->font
-                 && check_tag_type(tag, WPT_FONT, NULL)) || ((!cs.font_size
-                                                              || !cs.
-                                                              text_position)
-                                                             && tag->values->
-                                                             font
-                                                             &&
-                                                             check_tag_type
-                                                             (tag,
-                                                              WPT_FONT_SIZE,
-                                                              NULL)))
+                 && check_tag_type(buffer->priv, tag, WPT_CAT_FONT, NULL))
+                || ((!cs.font_size || !cs.text_position) && tag->values->font
+                    && check_tag_type(buffer->priv, tag, WPT_CAT_FONT_SIZE,
+                                      NULL)))
             {
                 if (tag->justification_set && gtk_text_iter_is_end(end) &&
                     tag->values->justification !=
@@ -1935,108 +2811,139 @@ wp_text_buffer_copy_tag_attributes(WPTextBuffer * buffer,
     wp_text_buffer_apply_attributes(buffer, start, end, FALSE, NULL);
 }
 
-/**
- * Remove all the tags with id <i>tagid</i> between <i>start</i> and
- * <i>end</i> interval.
- * @param buffer is a #GtkTextBuffer
- * @param start a position in the buffer
- * @param end a position in the buffer
- * @param tagid is the id identifying the tag to be removed (WPT_x)
- */
+static gboolean
+tag_in_range(GtkTextTag * tag, const GtkTextIter * start,
+             const GtkTextIter * end)
+{
+    GtkTextIter iter = *start;
+
+    if (gtk_text_iter_has_tag(start, tag))
+        return TRUE;
+    return gtk_text_iter_forward_to_tag_toggle(&iter, tag) &&
+        gtk_text_iter_compare(&iter, end) < 0;
+}
+
+static gboolean
+range_has_image(WPTextBuffer * buffer, const GtkTextIter * start,
+                const GtkTextIter * end)
+{
+    return tag_in_range(buffer->priv->tag_set->image_tag, start, end);
+}
+
 static void
-remove_tags_with_id(WPTextBuffer * buffer, GtkTextIter * start,
-                    GtkTextIter * end, gint tagid)
+clear_range_tags(WPTextBuffer * buffer, GtkTextIter * start,
+                 GtkTextIter * end)
 {
-    GSList *tags, *tags_head;
-    GtkTextTag *tag = NULL;
-    GtkTextIter tmp;
-    GtkTextBuffer *text_buffer;
+    WPTextBufferPrivate *priv = buffer->priv;
+    GHashTableIter hash_iter;
+    GtkTextIter iter = *start;
+    gpointer key;
+    gboolean undo;
 
-    g_return_if_fail(buffer);
+    if (!gtk_text_iter_forward_to_tag_toggle(&iter, NULL) ||
+        gtk_text_iter_compare(&iter, end) >= 0)
+        return;
 
-    tags_head = tags = gtk_text_iter_get_tags(start);
-    tmp = *start;
-    text_buffer = GTK_TEXT_BUFFER(buffer);
+    undo = wp_undo_is_enabled(priv->undo);
+    if (undo)
+        wp_undo_freeze(priv->undo);
+
+    g_hash_table_iter_init(&hash_iter, priv->tag_hash);
+    while (g_hash_table_iter_next(&hash_iter, &key, NULL))
+        if (tag_in_range(GTK_TEXT_TAG(key), start, end))
+            gtk_text_buffer_remove_tag(GTK_TEXT_BUFFER(buffer),
+                                       GTK_TEXT_TAG(key), start, end);
+
+    if (undo)
+        wp_undo_thaw(priv->undo);
+}
 
-    do
+/**
+ * Check if a tag of <i>category</i> belongs to the tag id <i>tagid</i>
+ * @param category is a #WPTagCategory
+ * @param tagid is the id identifying the tags (WPT_x)
+ * @return <b>TRUE</b> if the category is part of the tag id
+ */
+static gboolean
+category_matches_id(WPTagCategory category, gint tagid)
+{
+    switch (tagid)
     {
-        while (tags)
-        {
-            tag = GTK_TEXT_TAG(tags->data);
-            tags = tags->next;
-            switch (tagid)
-            {
-                case WPT_FORECOLOR:
-                    if (tag->fg_color_set)
-                        gtk_text_buffer_remove_tag(text_buffer, tag, start,
-                                                   end);
-                    break;
-                case WPT_FONT:
-                    if (tag->values->font
-                        && check_tag_type(tag, WPT_FONT, NULL))
-                        gtk_text_buffer_remove_tag(text_buffer, tag, start,
-                                                   end);
-                    break;
-                case WPT_FONT_SIZE:
-                    if (tag->values->font
-                        && check_tag_type(tag, WPT_FONT_SIZE, NULL))
-                        gtk_text_buffer_remove_tag(text_buffer, tag, start,
-                                                   end);
-                    break;
-                case WPT_SUB_SRPT:
-                    if (tag->values->font
-                        && check_tag_type(tag, WPT_SUB_SRPT, NULL))
-                        gtk_text_buffer_remove_tag(text_buffer, tag, start,
-                                                   end);
-                    break;
-                case WPT_SUP_SRPT:
-                    if (tag->values->font
-                        && check_tag_type(tag, WPT_SUP_SRPT, NULL))
-                        gtk_text_buffer_remove_tag(text_buffer, tag, start,
-                                                   end);
-                    break;
-                case WPT_ALL_FONT_SIZE:
-                    if (tag->values->font && check_tag_fontsize_type(tag))
-                        gtk_text_buffer_remove_tag(text_buffer, tag, start,
-                                                   end);
-                    break;
-            }
-        }
+        case WPT_FORECOLOR:
+            return category == WPT_CAT_COLOR;
+        case WPT_FONT:
+            return category == WPT_CAT_FONT;
+        case WPT_FONT_SIZE:
+            return category == WPT_CAT_FONT_SIZE;
+        case WPT_SUB_SRPT:
+            return category == WPT_CAT_SUB_SRPT;
+        case WPT_SUP_SRPT:
+            return category == WPT_CAT_SUP_SRPT;
+        case WPT_ALL_FONT_SIZE:
+            return category == WPT_CAT_FONT_SIZE ||
+                category == WPT_CAT_SUB_SRPT || category == WPT_CAT_SUP_SRPT;
+        default:
+            return FALSE;
+    }
+}
 
-        g_slist_free(tags_head);
+/**
+ * Collect the registered tags of the categories identified by
+ * <i>tagid</i>, which are present between <i>start</i> and <i>end</i>.
+ * @param priv is the private structure of a #WPTextBuffer
+ * @param start a position in the buffer
+ * @param end a position in the buffer
+ * @param tagid is the id identifying the tags (WPT_x)
+ * @return a #GSList of the #GtkTextTag's, which should be freed
+ */
+static GSList *
+get_tags_with_id(WPTextBufferPrivate * priv, const GtkTextIter * start,
+                 const GtkTextIter * end, gint tagid)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    GSList *tags = NULL;
 
-        if (!gtk_text_iter_forward_to_tag_toggle(&tmp, NULL) ||
-            (gtk_text_iter_compare(&tmp, end) >= 0))
-            break;
+    g_hash_table_iter_init(&iter, priv->tag_hash);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+        if (category_matches_id(((WPTagInfo *) value)->category, tagid)
+            && tag_in_range(GTK_TEXT_TAG(key), start, end))
+            tags = g_slist_prepend(tags, key);
 
-        tags_head = tags = gtk_text_iter_get_toggled_tags(&tmp, TRUE);
-    } while (1);
+    return tags;
 }
 
 /**
- * Remove <i>tag</i> from <i>buffer</i>, and sets <i>end</i> to the tag
- * end or <i>buffer_end</i> if the tag toggle is after the end
+ * Remove all the tags with id <i>tagid</i> between <i>start</i> and
+ * <i>end</i> interval. The candidates are taken from the tag hash by their
+ * category, and every tag found in the interval is removed once.
  * @param buffer is a #GtkTextBuffer
- * @param tag is a #GtkTextTag
  * @param start a position in the buffer
- * @param end a position in the buffer, this is return parameter
- * @param buffer_end a position in the buffer
+ * @param end a position in the buffer
+ * @param tagid is the id identifying the tag to be removed (WPT_x)
  */
 static void
-remove_buffer_tag(GtkTextBuffer * text_buffer, GtkTextTag * tag,
-                  GtkTextIter * start, GtkTextIter * end,
-                  GtkTextIter * buffer_end)
+remove_tags_with_id(WPTextBuffer * buffer, GtkTextIter * start,
+                    GtkTextIter * end, gint tagid)
 {
-    *end = *start;
-    if (gtk_text_iter_forward_to_tag_toggle(end, tag))
-    {
-        if (gtk_text_iter_compare(end, buffer_end) > 0)
-            *end = *buffer_end;
-    }
-    else
-        *end = *buffer_end;
+    GSList *tags, *tmp;
+
+    g_return_if_fail(buffer);
 
-    gtk_text_buffer_remove_tag(text_buffer, tag, start, end);
+    tags = get_tags_with_id(buffer->priv, start, end, tagid);
+    for (tmp = tags; tmp; tmp = tmp->next)
+        gtk_text_buffer_remove_tag(GTK_TEXT_BUFFER(buffer),
+                                   GTK_TEXT_TAG(tmp->data), start, end);
+    g_slist_free(tags);
+}
+
+static GtkTextTag *
+get_position_tag(WPTextBufferPrivate * priv, TextPosition pos, gint size)
+{
+    return get_format_tag(priv,
+                          pos == TEXT_POSITION_SUPERSCRIPT ? WPT_CAT_SUP_SRPT :
+                          pos == TEXT_POSITION_SUBSCRIPT ? WPT_CAT_SUB_SRPT :
+                          WPT_CAT_FONT_SIZE, size);
 }
 
 /**
@@ -2052,105 +2959,64 @@ static void
 change_font_tags(WPTextBuffer * buffer, GtkTextIter * start,
                  GtkTextIter * end, gint size, TextPosition * pos)
 {
-    GSList *tags, *tags_head;
-    GtkTextTag *tag = NULL;
+    GSList *tags, *tmp_tags;
+    GtkTextTag *tag = NULL, *new_tag;
     GtkTextIter tmp, tmp_end;
     GtkTextBuffer *text_buffer;
     struct _WPTextBufferPrivate *priv;
+    WPTagInfo *info;
     gint n;
+    TextPosition tag_pos;
     gboolean font_size_tag_found = FALSE;
 
     g_return_if_fail(buffer);
 
-    tags_head = tags = gtk_text_iter_get_tags(start);
-    tmp = *start;
     text_buffer = GTK_TEXT_BUFFER(buffer);
     priv = buffer->priv;
 
-    do
+    /* The tags are collected first, because the new tags created below are
+     * added to the tag hash */
+    tags = get_tags_with_id(priv, start, end, WPT_ALL_FONT_SIZE);
+    for (tmp_tags = tags; tmp_tags; tmp_tags = tmp_tags->next)
     {
-        while (tags)
+        tag = GTK_TEXT_TAG(tmp_tags->data);
+        info = lookup_tag_info(priv, tag);
+        n = info->index;
+        tag_pos = info->category == WPT_CAT_SUB_SRPT ?
+            TEXT_POSITION_SUBSCRIPT :
+            info->category == WPT_CAT_SUP_SRPT ?
+            TEXT_POSITION_SUPERSCRIPT : TEXT_POSITION_NORMAL;
+
+        if (pos && *pos == tag_pos)
+            continue;
+
+        /* Either the size or the position is changed */
+        font_size_tag_found = TRUE;
+        new_tag = pos ? get_position_tag(priv, *pos, n) :
+            get_position_tag(priv, tag_pos, size);
+        if (new_tag == tag)
+            continue;
+
+        /* Apply the new tag over the runs of the old one, then remove the
+         * old tag from the whole interval at once */
+        tmp = *start;
+        if (!gtk_text_iter_has_tag(&tmp, tag))
+            gtk_text_iter_forward_to_tag_toggle(&tmp, tag);
+        while (gtk_text_iter_compare(&tmp, end) < 0)
         {
-            tag = GTK_TEXT_TAG(tags->data);
-            tags = tags->next;
-
-            if (tag->values->font)
-            {
-                if (check_tag_type(tag, WPT_FONT_SIZE, &n) &&
-                    (!pos || *pos != TEXT_POSITION_NORMAL))
-                {
-                    remove_buffer_tag(text_buffer, tag, &tmp, &tmp_end, end);
-                    font_size_tag_found = TRUE;
-
-                    if (!pos)
-                        gtk_text_buffer_apply_tag(text_buffer,
-                                                  priv->
-                                                  font_size_tags[size],
-                                                  &tmp, &tmp_end);
-                    else if (*pos == TEXT_POSITION_SUBSCRIPT)
-                        gtk_text_buffer_apply_tag(text_buffer,
-                                                  priv->
-                                                  font_size_sub_tags[n],
-                                                  &tmp, &tmp_end);
-                    else
-                        gtk_text_buffer_apply_tag(text_buffer,
-                                                  priv->
-                                                  font_size_sup_tags[n],
-                                                  &tmp, &tmp_end);
-                }
-                else if (check_tag_type(tag, WPT_SUB_SRPT, &n)
-                         && (!pos || *pos != TEXT_POSITION_SUBSCRIPT))
-                {
-                    remove_buffer_tag(text_buffer, tag, &tmp, &tmp_end, end);
-                    font_size_tag_found = TRUE;
-
-                    if (!pos)
-                        gtk_text_buffer_apply_tag(text_buffer,
-                                                  priv->
-                                                  font_size_sub_tags[size],
-                                                  &tmp, &tmp_end);
-                    else if (*pos == TEXT_POSITION_NORMAL)
-                        gtk_text_buffer_apply_tag(text_buffer,
-                                                  priv->font_size_tags[n],
-                                                  &tmp, &tmp_end);
-                    else
-                        gtk_text_buffer_apply_tag(text_buffer,
-                                                  priv->
-                                                  font_size_sup_tags[n],
-                                                  &tmp, &tmp_end);
-                }
-                else if (check_tag_type(tag, WPT_SUP_SRPT, &n)
-                         && (!pos || *pos != TEXT_POSITION_SUPERSCRIPT))
-                {
-                    remove_buffer_tag(text_buffer, tag, &tmp, &tmp_end, end);
-                    font_size_tag_found = TRUE;
-
-                    if (!pos)
-                        gtk_text_buffer_apply_tag(text_buffer,
-                                                  priv->
-                                                  font_size_sup_tags[size],
-                                                  &tmp, &tmp_end);
-                    else if (*pos == TEXT_POSITION_NORMAL)
-                        gtk_text_buffer_apply_tag(text_buffer,
-                                                  priv->font_size_tags[n],
-                                                  &tmp, &tmp_end);
-                    else
-                        gtk_text_buffer_apply_tag(text_buffer,
-                                                  priv->
-                                                  font_size_sub_tags[n],
-                                                  &tmp, &tmp_end);
-                }
-            }
+            tmp_end = tmp;
+            if (!gtk_text_iter_forward_to_tag_toggle(&tmp_end, tag) ||
+                gtk_text_iter_compare(&tmp_end, end) > 0)
+                tmp_end = *end;
+            gtk_text_buffer_apply_tag(text_buffer, new_tag, &tmp, &tmp_end);
+
+            tmp = tmp_end;
+            if (!gtk_text_iter_forward_to_tag_toggle(&tmp, tag))
+                break;
         }
-
-        g_slist_free(tags_head);
-
-        if (!gtk_text_iter_forward_to_tag_toggle(&tmp, NULL) ||
-            (gtk_text_iter_compare(&tmp, end) >= 0))
-            break;
-
-        tags_head = tags = gtk_text_iter_get_toggled_tags(&tmp, TRUE);
-    } while (1);
+        gtk_text_buffer_remove_tag(text_buffer, tag, start, end);
+    }
+    g_slist_free(tags);
 
     /* If no font size tag was found, we need to set at least one new font
      * size tag */
@@ -2167,20 +3033,11 @@ change_font_tags(WPTextBuffer * buffer, GtkTextIter * start,
               tmp_end = *end;
         }
 
-        if (!pos || *pos == TEXT_POSITION_NORMAL)
-            gtk_text_buffer_apply_tag(text_buffer,
-                                      priv->
-                                      font_size_tags[size], &tmp, &tmp_end);
-        else if (*pos == TEXT_POSITION_SUBSCRIPT)
-            gtk_text_buffer_apply_tag(text_buffer,
-                                      priv->
-                                      font_size_sub_tags[size],
-                                      &tmp, &tmp_end);
-        else
-            gtk_text_buffer_apply_tag(text_buffer,
-                                      priv->
-                                      font_size_sup_tags[size],
-                                      &tmp, &tmp_end);
+        gtk_text_buffer_apply_tag(text_buffer,
+                                  get_position_tag(priv,
+                                                   pos ? *pos :
+                                                   TEXT_POSITION_NORMAL,
+                                                   size), &tmp, &tmp_end);
     }
 }
 
@@ -2214,13 +3071,6 @@ wp_text_buffer_apply_attributes(WPTextBuffer * buffer, GtkTextIter * start,
         ttags = buffer->priv->tags;
         text_buffer = GTK_TEXT_BUFFER(buffer);
 
-        if (gtk_text_iter_ends_tag(start, buffer->priv->tags[WPT_BULLET]))
-        {
-            gtk_text_iter_backward_char(start);
-            _wp_text_iter_skip_bullet(start, buffer->priv->tags[WPT_BULLET],
-                                      FALSE);
-        }
-
         if (cs.justification)
         {
             siter = *start;
@@ -2390,8 +3240,8 @@ wp_text_buffer_apply_attributes(WPTextBuffer * buffer, GtkTextIter * start,
                                              &fmt->color,
                                              ttags[WPT_RIGHT]->priority + 1);
 
+                    register_tag(priv, tag, WPT_CAT_COLOR, 0);
                     gtk_text_buffer_apply_tag(text_buffer, tag, start, end);
-                    g_hash_table_insert(priv->tag_hash, tag, NULL);
                 }
             }
             if (cs.font)
@@ -2399,7 +3249,8 @@ wp_text_buffer_apply_attributes(WPTextBuffer * buffer, GtkTextIter * start,
                 if (undo)
                     remove_tags_with_id(buffer, start, end, WPT_FONT);
                 gtk_text_buffer_apply_tag(text_buffer,
-                                          buffer->priv->fonts[fmt->font],
+                                          get_format_tag(priv, WPT_CAT_FONT,
+                                                         fmt->font),
                                           start, end);
             }
             if (cs.font_size && cs.text_position)
@@ -2407,30 +3258,11 @@ wp_text_buffer_apply_attributes(WPTextBuffer * buffer, GtkTextIter * start,
                 if (undo)
                     remove_tags_with_id(buffer, start, end,
                                         WPT_ALL_FONT_SIZE);
-                switch (fmt->text_position)
-                {
-                    case TEXT_POSITION_NORMAL:
-                        gtk_text_buffer_apply_tag(text_buffer,
-                                                  buffer->priv->
-                                                  font_size_tags[fmt->
-                                                                 font_size],
-                                                  start, end);
-                        break;
-                    case TEXT_POSITION_SUPERSCRIPT:
-                        gtk_text_buffer_apply_tag(text_buffer,
-                                                  buffer->priv->
-                                                  font_size_sup_tags[fmt->
-                                                                     font_size],
-                                                  start, end);
-                        break;
-                    case TEXT_POSITION_SUBSCRIPT:
-                        gtk_text_buffer_apply_tag(text_buffer,
-                                                  buffer->priv->
-                                                  font_size_sub_tags[fmt->
-                                                                     font_size],
-                                                  start, end);
-                        break;
-                }
+                gtk_text_buffer_apply_tag(text_buffer,
+                                          get_position_tag(priv,
+                                                           fmt->text_position,
+                                                           fmt->font_size),
+                                          start, end);
             }
             else if ((cs.font_size && !cs.text_position) ||
                      (!cs.font_size && cs.text_position))
@@ -2459,8 +3291,8 @@ wp_text_buffer_insert_with_attribute(WPTextBuffer * buffer,
                                      gboolean disable_undo)
 {
     g_return_if_fail(WP_IS_TEXT_BUFFER(buffer));
-    gint offset;
-    GtkTextIter start, end;
+    gint offset, line;
+    GtkTextIter start;
     GtkTextBuffer *text_buffer = GTK_TEXT_BUFFER(buffer);
     WPTextBufferPrivate *priv = buffer->priv;
 
@@ -2475,17 +3307,10 @@ wp_text_buffer_insert_with_attribute(WPTextBuffer * buffer,
 
     wp_text_buffer_apply_attributes(buffer, &start, pos, !disable_undo, fmt);
 
-    if (fmt->bullet)
-    {
-        GtkTextTag *tag = _wp_text_buffer_get_bullet_tag(buffer);
-        if (_wp_text_iter_put_bullet_line(&start, tag))
-        {
-            end = start;
-            gtk_text_iter_set_line_offset(&start, 0);
-            wp_text_buffer_apply_attributes(buffer, &start, &end,
-                                            !disable_undo, fmt);
-        }
-    }
+    line = gtk_text_iter_get_line(&start);
+    if (fmt->bullet &&
+        wp_text_buffer_get_list_type(buffer, line) == WP_LIST_NONE)
+        _wp_text_buffer_set_line_list_type(buffer, line, WP_LIST_BULLET);
 
     gtk_text_buffer_end_user_action(text_buffer);
 
@@ -2493,36 +3318,186 @@ wp_text_buffer_insert_with_attribute(WPTextBuffer * buffer,
         wp_undo_thaw(buffer->priv->undo);
 }
 
-void
-wp_text_buffer_insert_image(WPTextBuffer * buffer,
-                            GtkTextIter * pos,
-                            const gchar * image_id, GdkPixbuf * pixbuf)
+/**
+ * Get the registry entry of <i>image_id</i>
+ * @param set is the #WPTagSet holding the image tags
+ * @param image_id the image id
+ * @param create is <b>TRUE</b> if a missing entry should be created
+ * @return the #WPImageEntry or <b>NULL</b>
+ */
+static WPImageEntry *
+get_image_entry(WPTagSet * set, const gchar * image_id, gboolean create)
+{
+    WPImageEntry *entry = g_hash_table_lookup(set->images, image_id);
+
+    if (!entry && create)
+    {
+        entry = g_new0(WPImageEntry, 1);
+        g_hash_table_insert(set->images, g_strdup(image_id), entry);
+    }
+
+    return entry;
+}
+
+/**
+ * Find the tag called "<i>prefix</i><i>image_id</i>" in the tag table. The
+ * tag table can be shared, so the tag may have been created by another
+ * buffer.
+ * @param buffer is a #WPTextBuffer
+ * @param prefix is the prefix of the tag name
+ * @param image_id the image id
+ * @param create is <b>TRUE</b> if a missing tag should be created
+ * @return the #GtkTextTag or <b>NULL</b>
+ */
+static GtkTextTag *
+lookup_image_tag(WPTextBuffer * buffer, const gchar * prefix,
+                 const gchar * image_id, gboolean create)
 {
-    GtkTextTag *pixbuf_tag;
     GtkTextTagTable *tag_table;
-    GtkTextIter iter2;
+    GtkTextTag *tag;
     gchar *tag_id;
-    gchar *img_id_copy = NULL;
-    g_return_if_fail(WP_IS_TEXT_BUFFER(buffer));
-    g_return_if_fail(image_id);
 
-    img_id_copy = g_strdup(image_id);
+    tag_id = g_strconcat(prefix, image_id, NULL);
+    tag_table = gtk_text_buffer_get_tag_table(GTK_TEXT_BUFFER(buffer));
+    tag = gtk_text_tag_table_lookup(tag_table, tag_id);
+    if (tag == NULL && create)
+        tag = gtk_text_buffer_create_tag(GTK_TEXT_BUFFER(buffer), tag_id,
+                                         NULL);
+    g_free(tag_id);
+
+    return tag;
+}
+
+/**
+ * Get the tag applied to the images with <i>image_id</i>
+ * @param buffer is a #WPTextBuffer
+ * @param image_id the image id
+ * @param create is <b>TRUE</b> if a missing tag should be created
+ * @return the #GtkTextTag or <b>NULL</b>
+ */
+static GtkTextTag *
+get_image_tag(WPTextBuffer * buffer, const gchar * image_id,
+              gboolean create)
+{
+    WPImageEntry *entry =
+        get_image_entry(buffer->priv->tag_set, image_id, TRUE);
+    WPTagInfo *info;
+
+    if (!entry->tag)
+    {
+        entry->tag = lookup_image_tag(buffer, "image-tag-", image_id,
+                                      create);
+        if (!entry->tag)
+            return NULL;
+        info = register_tag(buffer->priv, entry->tag, WPT_CAT_IMAGE, 0);
+        g_free(info->image_id);
+        info->image_id = g_strdup(image_id);
+    }
+
+    return entry->tag;
+}
 
-    tag_id = g_strdup_printf("image-tag-%s", image_id);
-    tag_table = gtk_text_buffer_get_tag_table (GTK_TEXT_BUFFER (buffer));
-    pixbuf_tag = gtk_text_tag_table_lookup (tag_table, tag_id);
-    if (pixbuf_tag == NULL)
-        pixbuf_tag = gtk_text_buffer_create_tag (GTK_TEXT_BUFFER (buffer), tag_id, NULL);
-    g_object_set_data_full (G_OBJECT (pixbuf_tag), "image-index", img_id_copy, (GDestroyNotify) g_free);
+GtkTextTag *
+_wp_text_buffer_get_image_replace_tag(WPTextBuffer * buffer,
+                                      const gchar * image_id,
+                                      gboolean create)
+{
+    WPImageEntry *entry =
+        get_image_entry(buffer->priv->tag_set, image_id, TRUE);
+    WPTagInfo *info;
+
+    if (!entry->replace_tag)
+    {
+        entry->replace_tag =
+            lookup_image_tag(buffer, "image-tag-replace-", image_id, create);
+        if (!entry->replace_tag)
+            return NULL;
+        info = register_tag(buffer->priv, entry->replace_tag, WPT_CAT_IMAGE,
+                            1);
+        g_free(info->image_id);
+        info->image_id = g_strdup(image_id);
+    }
+
+    return entry->replace_tag;
+}
+
+/**
+ * Insert an image at <i>pos</i>, without resetting the undo queue
+ * @param buffer is a #WPTextBuffer
+ * @param pos a position in the buffer, moved after the image
+ * @param image_id the image id
+ * @param pixbuf the image
+ */
+static void
+insert_image(WPTextBuffer * buffer, GtkTextIter * pos,
+             const gchar * image_id, GdkPixbuf * pixbuf)
+{
+    GtkTextTag *pixbuf_tag = get_image_tag(buffer, image_id, TRUE);
+    GtkTextIter iter2;
 
-    g_object_set_data(G_OBJECT(pixbuf_tag), "image-set",
-                      GINT_TO_POINTER(TRUE));
     gtk_text_buffer_insert_pixbuf(GTK_TEXT_BUFFER(buffer), pos, pixbuf);
     iter2 = *pos;
     gtk_text_iter_backward_char(&iter2);
     gtk_text_buffer_apply_tag(GTK_TEXT_BUFFER(buffer), pixbuf_tag, &iter2,
                               pos);
-    g_free(tag_id);
+}
+
+/**
+ * Replace the placeholders of <i>image_id</i> with <i>pixbuf</i>. The
+ * placeholders are found by jumping between the toggles of their tag.
+ * @param buffer is a #WPTextBuffer
+ * @param image_id the image id
+ * @param pixbuf the image
+ * @return <b>TRUE</b> if a placeholder has been replaced
+ */
+static gboolean
+replace_image(WPTextBuffer * buffer, const gchar * image_id,
+              GdkPixbuf * pixbuf)
+{
+    GtkTextBuffer *text_buffer = GTK_TEXT_BUFFER(buffer);
+    GtkTextTag *tag;
+    GtkTextIter iter, end;
+    gboolean result = FALSE;
+    gint count;
+
+    tag = _wp_text_buffer_get_image_replace_tag(buffer, image_id, FALSE);
+    if (!tag)
+        return FALSE;
+
+    gtk_text_buffer_get_start_iter(text_buffer, &iter);
+    if (!gtk_text_iter_begins_tag(&iter, tag) &&
+        !gtk_text_iter_forward_to_tag_toggle(&iter, tag))
+        return FALSE;
+
+    while (!gtk_text_iter_is_end(&iter))
+    {
+        /* Every character of the run is a placeholder */
+        end = iter;
+        gtk_text_iter_forward_to_tag_toggle(&end, tag);
+        count = gtk_text_iter_get_offset(&end) -
+            gtk_text_iter_get_offset(&iter);
+
+        gtk_text_buffer_delete(text_buffer, &iter, &end);
+        while (count-- > 0)
+            insert_image(buffer, &iter, image_id, pixbuf);
+        result = TRUE;
+
+        if (!gtk_text_iter_forward_to_tag_toggle(&iter, tag))
+            break;
+    }
+
+    return result;
+}
+
+void
+wp_text_buffer_insert_image(WPTextBuffer * buffer,
+                            GtkTextIter * pos,
+                            const gchar * image_id, GdkPixbuf * pixbuf)
+{
+    g_return_if_fail(WP_IS_TEXT_BUFFER(buffer));
+    g_return_if_fail(image_id);
+
+    insert_image(buffer, pos, image_id, pixbuf);
     buffer->priv->queue_undo_reset = TRUE;
     wp_undo_reset (buffer->priv->undo);
 
@@ -2532,36 +3507,36 @@ void wp_text_buffer_replace_image (WPTextBuffer *buffer,
                                   const gchar *image_id,
                                   GdkPixbuf *pixbuf)
 {
-    GtkTextIter iter, start, end;
-    gchar *replace_tag_id;
     g_return_if_fail (WP_IS_TEXT_BUFFER(buffer));
     g_return_if_fail (image_id);
-    GtkTextTagTable *tag_table;
-    GtkTextTag *tag;
 
-    replace_tag_id = g_strdup_printf ("image-tag-replace-%s", image_id);
+    wp_text_buffer_replace_images (buffer, &image_id, &pixbuf, 1);
+}
+
+void
+wp_text_buffer_replace_images(WPTextBuffer * buffer,
+                              const gchar * const *image_ids,
+                              GdkPixbuf * const *pixbufs, gint n)
+{
+    gboolean replaced = FALSE;
+    gint i;
+
+    g_return_if_fail(WP_IS_TEXT_BUFFER(buffer));
+    g_return_if_fail(image_ids || n == 0);
+    g_return_if_fail(pixbufs || n == 0);
 
-    tag_table = gtk_text_buffer_get_tag_table (GTK_TEXT_BUFFER (buffer));
-    tag = gtk_text_tag_table_lookup (tag_table, (const gchar *) replace_tag_id);
+    freeze_cursor_moved(buffer);
+    wp_undo_freeze(buffer->priv->undo);
+    for (i = 0; i < n; i++)
+        if (image_ids[i])
+            replaced |= replace_image(buffer, image_ids[i], pixbufs[i]);
+    wp_undo_thaw(buffer->priv->undo);
+    thaw_cursor_moved(buffer);
 
-    if (tag) {
-       gtk_text_buffer_get_start_iter (GTK_TEXT_BUFFER (buffer), &iter);
-
-       wp_undo_freeze (buffer->priv->undo);
-       while (!gtk_text_iter_is_end (&iter)) {
-           if (gtk_text_iter_begins_tag (&iter, tag)) {
-               GtkTextIter end;
-               wp_text_buffer_insert_image (buffer, &iter, image_id, pixbuf);
-               end = iter;
-               gtk_text_iter_forward_char (&iter);
-               gtk_text_buffer_delete(GTK_TEXT_BUFFER (buffer), &iter, &end);
-           }
-           gtk_text_iter_forward_char (&iter);
-       }
-       wp_undo_thaw (buffer->priv->undo);
-       gtk_text_buffer_get_start_iter (GTK_TEXT_BUFFER (buffer), &start);
-       gtk_text_buffer_get_end_iter (GTK_TEXT_BUFFER (buffer), &end);
-       gtk_text_buffer_remove_tag (GTK_TEXT_BUFFER (buffer), tag, &start, &end);
+    if (replaced)
+    {
+        buffer->priv->queue_undo_reset = TRUE;
+        wp_undo_reset(buffer->priv->undo);
     }
 }
 
@@ -2569,22 +3544,12 @@ void wp_text_buffer_insert_image_replacement (WPTextBuffer *buffer,
                                              GtkTextIter *pos,
                                              const gchar *image_id)
 {
-    GtkTextTag *pixbuf_tag;
-    GtkTextTagTable *tag_table;
-    gchar *tag_id;
-    //gchar * img_id_copy = NULL;
     g_return_if_fail(WP_IS_TEXT_BUFFER(buffer));
     g_return_if_fail (image_id);
-    
-    //img_id_copy = g_strdup (image_id);
 
-    tag_id = g_strdup_printf("image-tag-replace-%s", image_id);
-    tag_table = gtk_text_buffer_get_tag_table (GTK_TEXT_BUFFER (buffer));
-    pixbuf_tag = gtk_text_tag_table_lookup (tag_table, tag_id);
-    if (pixbuf_tag == NULL)
-        pixbuf_tag = gtk_text_buffer_create_tag (GTK_TEXT_BUFFER (buffer), tag_id, NULL);
-    gtk_text_buffer_insert_with_tags (GTK_TEXT_BUFFER (buffer), pos, " ", 1, pixbuf_tag, NULL);
-    g_free (tag_id);
+    gtk_text_buffer_insert_with_tags (GTK_TEXT_BUFFER (buffer), pos, " ", 1,
+                                      _wp_text_buffer_get_image_replace_tag
+                                      (buffer, image_id, TRUE), NULL);
 }
 
 
@@ -2592,21 +3557,16 @@ void wp_text_buffer_insert_image_replacement (WPTextBuffer *buffer,
 void
 wp_text_buffer_delete_image(WPTextBuffer * buffer, const gchar * image_id)
 {
-    GtkTextTagTable *tag_table;
-    gchar *tag_id;
     GtkTextTag *tag;
     GtkTextIter start, end;
     g_return_if_fail(WP_IS_TEXT_BUFFER(buffer));
 
-    tag_table = gtk_text_buffer_get_tag_table(GTK_TEXT_BUFFER(buffer));
-    tag_id = g_strdup_printf("image-tag-%s", image_id);
-    tag = gtk_text_tag_table_lookup(tag_table, tag_id);
-    g_free(tag_id);
-
+    tag = get_image_tag(buffer, image_id, FALSE);
     if (tag != NULL)
     {
         gtk_text_buffer_get_start_iter(GTK_TEXT_BUFFER(buffer), &start);
-        gtk_text_iter_forward_to_tag_toggle(&start, tag);
+        if (!gtk_text_iter_begins_tag(&start, tag))
+            gtk_text_iter_forward_to_tag_toggle(&start, tag);
         end = start;
         gtk_text_iter_forward_to_tag_toggle(&end, tag);
         gtk_text_buffer_remove_tag(GTK_TEXT_BUFFER(buffer), tag, &start,
@@ -2731,14 +3691,409 @@ wp_text_buffer_set_format(WPTextBuffer * buffer, WPTextBufferFormat * fmt)
 
     // printf("Attributes: %d\n", send);
     if (fmt && send)
-        g_signal_emit(buffer, signals[REFRESH_ATTRIBUTES], 0);
+        emit_refresh_signals(buffer);
 
     return !send;
 }
 
+/** Attribute groups merged and applied separately by
+ * #wp_text_buffer_apply_formats */
+typedef enum {
+    WP_FORMAT_KIND_BOLD = 0,
+    WP_FORMAT_KIND_ITALIC,
+    WP_FORMAT_KIND_UNDERLINE,
+    WP_FORMAT_KIND_STRIKE,
+    WP_FORMAT_KIND_COLOR,
+    WP_FORMAT_KIND_FONT,
+    WP_FORMAT_KIND_SIZE,
+    WP_FORMAT_KIND_JUSTIFICATION,
+    WP_FORMAT_KIND_LAST
+} WPFormatKind;
+
+/** A range of #WPFormatRange, normalized for one #WPFormatKind */
+typedef struct {
+    /** Start offset of the span */
+    gint start;
+    /** End offset of the span */
+    gint end;
+    /** Position of the range in the array passed by the caller */
+    gint index;
+    /** The format of the range */
+    const WPTextBufferFormat *fmt;
+} WPFormatSpan;
+
+/**
+ * Check if the attributes of <i>kind</i> are present in the changeset of
+ * <i>fmt</i>
+ * @param fmt is a #WPTextBufferFormat
+ * @param kind is a #WPFormatKind
+ * @return <b>TRUE</b> if <i>fmt</i> changes the attributes
+ */
+static gboolean
+format_kind_is_set(const WPTextBufferFormat * fmt, WPFormatKind kind)
+{
+    switch (kind)
+    {
+        case WP_FORMAT_KIND_BOLD:
+            return fmt->cs.bold;
+        case WP_FORMAT_KIND_ITALIC:
+            return fmt->cs.italic;
+        case WP_FORMAT_KIND_UNDERLINE:
+            return fmt->cs.underline;
+        case WP_FORMAT_KIND_STRIKE:
+            return fmt->cs.strikethrough;
+        case WP_FORMAT_KIND_COLOR:
+            return fmt->cs.color;
+        case WP_FORMAT_KIND_FONT:
+            return fmt->cs.font;
+        case WP_FORMAT_KIND_SIZE:
+            return fmt->cs.font_size || fmt->cs.text_position;
+        case WP_FORMAT_KIND_JUSTIFICATION:
+            return fmt->cs.justification;
+        default:
+            return FALSE;
+    }
+}
+
+/**
+ * Compare the attributes of <i>kind</i> from two formats
+ * @param a is a #WPTextBufferFormat
+ * @param b is a #WPTextBufferFormat
+ * @param kind is a #WPFormatKind
+ * @return <b>TRUE</b> if applying <i>a</i> or <i>b</i> gives the same result
+ */
+static gboolean
+format_kind_equal(const WPTextBufferFormat * a, const WPTextBufferFormat * b,
+                  WPFormatKind kind)
+{
+    switch (kind)
+    {
+        case WP_FORMAT_KIND_BOLD:
+            return !a->bold == !b->bold;
+        case WP_FORMAT_KIND_ITALIC:
+            return !a->italic == !b->italic;
+        case WP_FORMAT_KIND_UNDERLINE:
+            return !a->underline == !b->underline;
+        case WP_FORMAT_KIND_STRIKE:
+            return !a->strikethrough == !b->strikethrough;
+        case WP_FORMAT_KIND_COLOR:
+            return a->color.red == b->color.red &&
+                a->color.green == b->color.green &&
+                a->color.blue == b->color.blue;
+        case WP_FORMAT_KIND_FONT:
+            return a->font == b->font;
+        case WP_FORMAT_KIND_SIZE:
+            return !a->cs.font_size == !b->cs.font_size &&
+                !a->cs.text_position == !b->cs.text_position &&
+                (!a->cs.font_size || a->font_size == b->font_size) &&
+                (!a->cs.text_position ||
+                 a->text_position == b->text_position);
+        case WP_FORMAT_KIND_JUSTIFICATION:
+            return a->justification == b->justification;
+        default:
+            return FALSE;
+    }
+}
+
+/**
+ * Order the spans by their start offset, and keep the order of the caller
+ * for the spans starting at the same position
+ * @param a is a #WPFormatSpan
+ * @param b is a #WPFormatSpan
+ * @return -1, 0, 1 like strcmp
+ */
+static gint
+cmp_format_spans(const void *a, const void *b)
+{
+    const WPFormatSpan *sa = (const WPFormatSpan *) a;
+    const WPFormatSpan *sb = (const WPFormatSpan *) b;
+
+    if (sa->start != sb->start)
+        return sa->start < sb->start ? -1 : 1;
+    return sa->index - sb->index;
+}
+
+/**
+ * Extend the interval between <i>start</i> and <i>end</i> to whole lines,
+ * the same way as the justification is applied by
+ * #wp_text_buffer_apply_attributes
+ * @param start a position in the buffer
+ * @param end a position in the buffer
+ */
+static void
+extend_to_lines(GtkTextIter * start, GtkTextIter * end)
+{
+    gtk_text_iter_set_line_offset(start, 0);
+    if (!gtk_text_iter_ends_line(end))
+    {
+        gtk_text_iter_forward_to_line_end(end);
+        gtk_text_iter_forward_char(end);
+    }
+    else if (gtk_text_iter_equal(start, end))
+        gtk_text_iter_forward_char(end);
+}
+
+/**
+ * Apply the attributes of <i>kind</i> from <i>fmt</i> between the
+ * <i>start</i> and <i>end</i> offsets. The tags of the same kind which are
+ * present in the interval are replaced.
+ * @param buffer is a #WPTextBuffer
+ * @param kind is a #WPFormatKind
+ * @param start start offset of the interval
+ * @param end end offset of the interval
+ * @param fmt is a #WPTextBufferFormat
+ */
+static void
+apply_format_span(WPTextBuffer * buffer, WPFormatKind kind, gint start,
+                  gint end, const WPTextBufferFormat * fmt)
+{
+    static const gint simple_tags[] = {
+        WPT_BOLD, WPT_ITALIC, WPT_UNDERLINE, WPT_STRIKE
+    };
+    static const gint justify_tags[] = { WPT_LEFT, WPT_CENTER, WPT_RIGHT };
+    static const gint justify_values[] = {
+        GTK_JUSTIFY_LEFT, GTK_JUSTIFY_CENTER, GTK_JUSTIFY_RIGHT
+    };
+    GtkTextBuffer *text_buffer = GTK_TEXT_BUFFER(buffer);
+    WPTextBufferPrivate *priv = buffer->priv;
+    GtkTextIter siter, eiter;
+    GtkTextTag *tag;
+    TextPosition position;
+    gboolean enable = FALSE;
+    gint i;
+
+    gtk_text_buffer_get_iter_at_offset(text_buffer, &siter, start);
+    gtk_text_buffer_get_iter_at_offset(text_buffer, &eiter, end);
+
+    switch (kind)
+    {
+        case WP_FORMAT_KIND_BOLD:
+            enable = fmt->bold;
+            break;
+        case WP_FORMAT_KIND_ITALIC:
+            enable = fmt->italic;
+            break;
+        case WP_FORMAT_KIND_UNDERLINE:
+            enable = fmt->underline;
+            break;
+        case WP_FORMAT_KIND_STRIKE:
+            enable = fmt->strikethrough;
+            break;
+        case WP_FORMAT_KIND_COLOR:
+            remove_tags_with_id(buffer, &siter, &eiter, WPT_FORECOLOR);
+            if (fmt->color.red || fmt->color.blue || fmt->color.green)
+            {
+                tag = color_buffer_get_tag(priv->color_tags, &fmt->color,
+                                           priv->tags[WPT_RIGHT]->priority +
+                                           1);
+                register_tag(priv, tag, WPT_CAT_COLOR, 0);
+                gtk_text_buffer_apply_tag(text_buffer, tag, &siter, &eiter);
+            }
+            return;
+        case WP_FORMAT_KIND_FONT:
+            remove_tags_with_id(buffer, &siter, &eiter, WPT_FONT);
+            gtk_text_buffer_apply_tag(text_buffer,
+                                      get_format_tag(priv, WPT_CAT_FONT,
+                                                     fmt->font),
+                                      &siter, &eiter);
+            return;
+        case WP_FORMAT_KIND_SIZE:
+            if (fmt->cs.font_size && fmt->cs.text_position)
+            {
+                remove_tags_with_id(buffer, &siter, &eiter,
+                                    WPT_ALL_FONT_SIZE);
+                gtk_text_buffer_apply_tag(text_buffer,
+                                          get_position_tag(priv,
+                                                           fmt->text_position,
+                                                           fmt->font_size),
+                                          &siter, &eiter);
+            }
+            else
+            {
+                position = fmt->text_position;
+                change_font_tags(buffer, &siter, &eiter, fmt->font_size,
+                                 fmt->cs.font_size ? NULL : &position);
+            }
+            return;
+        case WP_FORMAT_KIND_JUSTIFICATION:
+            for (i = 0; i < G_N_ELEMENTS(justify_tags); i++)
+                if (fmt->justification == justify_values[i])
+                    gtk_text_buffer_apply_tag(text_buffer,
+                                              priv->tags[justify_tags[i]],
+                                              &siter, &eiter);
+                else
+                    gtk_text_buffer_remove_tag(text_buffer,
+                                               priv->tags[justify_tags[i]],
+                                               &siter, &eiter);
+            return;
+        default:
+            return;
+    }
+
+    if (enable)
+        gtk_text_buffer_apply_tag(text_buffer, priv->tags[simple_tags[kind]],
+                                  &siter, &eiter);
+    else
+        gtk_text_buffer_remove_tag(text_buffer, priv->tags[simple_tags[kind]],
+                                   &siter, &eiter);
+}
+
+/**
+ * Apply the attributes of <i>kind</i> from the <i>ranges</i>. The ranges are
+ * sorted, and the overlapping or adjacent ranges with the same attributes are
+ * merged, so every tag is applied once for every merged span.
+ * @param buffer is a #WPTextBuffer
+ * @param kind is a #WPFormatKind
+ * @param ranges is an array of #WPFormatRange
+ * @param n is the number of elements in <i>ranges</i>
+ * @param spans is a working array with at least <i>n</i> elements
+ * @return <b>TRUE</b> if anything was applied
+ */
+static gboolean
+apply_format_kind(WPTextBuffer * buffer, WPFormatKind kind,
+                  const WPFormatRange * ranges, gint n, WPFormatSpan * spans)
+{
+    GtkTextBuffer *text_buffer = GTK_TEXT_BUFFER(buffer);
+    GtkTextIter siter, eiter;
+    WPFormatSpan current;
+    gint i, count = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        if (!format_kind_is_set(&ranges[i].fmt, kind))
+            continue;
+
+        gtk_text_buffer_get_iter_at_offset(text_buffer, &siter,
+                                           ranges[i].start);
+        gtk_text_buffer_get_iter_at_offset(text_buffer, &eiter,
+                                           ranges[i].end);
+        if (kind == WP_FORMAT_KIND_JUSTIFICATION)
+            extend_to_lines(&siter, &eiter);
+        if (gtk_text_iter_compare(&siter, &eiter) >= 0)
+            continue;
+
+        spans[count].start = gtk_text_iter_get_offset(&siter);
+        spans[count].end = gtk_text_iter_get_offset(&eiter);
+        spans[count].index = i;
+        spans[count].fmt = &ranges[i].fmt;
+        count++;
+    }
+
+    if (!count)
+        return FALSE;
+
+    qsort(spans, count, sizeof(WPFormatSpan), cmp_format_spans);
+
+    current = spans[0];
+    for (i = 1; i < count; i++)
+    {
+        if (spans[i].start <= current.end &&
+            format_kind_equal(current.fmt, spans[i].fmt, kind))
+        {
+            current.end = MAX(current.end, spans[i].end);
+        }
+        else
+        {
+            apply_format_span(buffer, kind, current.start, current.end,
+                              current.fmt);
+            current = spans[i];
+        }
+    }
+    apply_format_span(buffer, kind, current.start, current.end, current.fmt);
+
+    return TRUE;
+}
+
+gboolean
+wp_text_buffer_apply_formats(WPTextBuffer * buffer,
+                             const WPFormatRange * ranges, gint n,
+                             guint flags)
+{
+    g_return_val_if_fail(WP_IS_TEXT_BUFFER(buffer), FALSE);
+    g_return_val_if_fail(ranges != NULL || n == 0, FALSE);
+    GtkTextBuffer *text_buffer = GTK_TEXT_BUFFER(buffer);
+    WPTextBufferPrivate *priv = buffer->priv;
+    WPTextBufferFormatChangeSet cs;
+    WPFormatSpan *spans;
+    GtkTextIter start, end;
+    gboolean justify = FALSE, result = FALSE;
+    gint i, min_start = G_MAXINT, max_end = 0;
+    WPFormatKind kind;
+
+    if (n <= 0 || !priv->is_rich_text)
+        return FALSE;
+
+    for (i = 0; i < n; i++)
+    {
+        cs = ranges[i].fmt.cs;
+        if (!changeset_is_set(&cs))
+            continue;
+        min_start = MIN(min_start, ranges[i].start);
+        max_end = MAX(max_end, ranges[i].end);
+        justify |= ranges[i].fmt.cs.justification;
+    }
+    if (min_start > max_end)
+        return FALSE;
+
+    if (flags & WP_FORMAT_NO_UNDO)
+        wp_undo_freeze(priv->undo);
+    else
+        wp_undo_reset_mergeable(priv->undo);
+
+    gtk_text_buffer_begin_user_action(text_buffer);
+    wp_text_buffer_check_apply_tag(buffer);
+
+    gtk_text_buffer_get_iter_at_offset(text_buffer, &start, min_start);
+    gtk_text_buffer_get_iter_at_offset(text_buffer, &end, max_end);
+    if (justify)
+        extend_to_lines(&start, &end);
+    wp_undo_apply_tag(priv->undo, &start, &end, NULL, FALSE);
+
+    spans = g_new(WPFormatSpan, n);
+    for (kind = 0; kind < WP_FORMAT_KIND_LAST; kind++)
+        result |= apply_format_kind(buffer, kind, ranges, n, spans);
+    g_free(spans);
+
+    if (result)
+        gtk_text_buffer_set_modified(text_buffer, TRUE);
+
+    gtk_text_buffer_end_user_action(text_buffer);
+
+    if (flags & WP_FORMAT_NO_UNDO)
+        wp_undo_thaw(priv->undo);
+
+    if (result && !(flags & WP_FORMAT_NO_REFRESH))
+        emit_refresh_signals(buffer);
+
+    return result;
+}
+
+/**
+ * Check if <i>tag</i> is toggled inside the interval between <i>start</i>
+ * and <i>end</i>. The search relies on the per tag toggle summaries kept in
+ * the nodes of the #GtkTextBuffer B-tree, so the lines which doesn't
+ * contain the <i>tag</i> are skipped without being visited.
+ * @param tag is a #GtkTextTag
+ * @param start a position in the buffer
+ * @param end a position in the buffer
+ * @return <b>TRUE</b> if <i>tag</i> is toggled after <i>start</i> and before
+ *         <i>end</i>
+ */
+static gboolean
+tag_toggles_inside(GtkTextTag * tag, const GtkTextIter * start,
+                   const GtkTextIter * end)
+{
+    GtkTextIter iter = *start;
+
+    return gtk_text_iter_forward_to_tag_toggle(&iter, tag) &&
+        gtk_text_iter_compare(&iter, end) < 0;
+}
+
 /**
  * Update the toggled attributes in <i>cs</i> for the selection
- * between <i>start</i> and <i>end</i> in the <i>buffer</i>
+ * between <i>start</i> and <i>end</i> in the <i>buffer</i>. Instead of
+ * visiting every tag toggle of the selection, each category is checked
+ * through the toggles of it's own tags, stopping at the first one found.
  * @param buffer is a #GtkTextBuffer
  * @param start a position in the buffer
  * @param end a position in the buffer
@@ -2753,112 +4108,95 @@ update_toggled_attributes(WPTextBuffer * buffer, GtkTextIter * start,
 {
     GtkTextTag *tag;
     GtkTextTag **ttags;
-    GtkTextIter iter;
-    GSList *tags, *tags_head;
-    gint bullet_last_line = -1, line;
-
-    // printf("update_toggled_attributes\n");
-    if (fmt->bullet)
-        bullet_last_line = gtk_text_iter_get_line(start);
+    GHashTableIter hash_iter;
+    gpointer key, value;
+    gint line, last;
 
     ttags = buffer->priv->tags;
-    iter = *start;
-    while (gtk_text_iter_forward_to_tag_toggle(&iter, NULL))
-    {
-        if (gtk_text_iter_compare(&iter, end) >= 0)
-            break;
-        // printf("Offset: %d\n", gtk_text_iter_get_offset(&iter));
-        tags_head = gtk_text_iter_get_toggled_tags(&iter, FALSE);
-        tags = tags_head =
-            g_slist_concat(tags_head,
-                           gtk_text_iter_get_toggled_tags(&iter, TRUE));
 
-        while (tags)
+    if (!cs->bold)
+        cs->bold = tag_toggles_inside(ttags[WPT_BOLD], start, end);
+    if (!cs->italic)
+        cs->italic = tag_toggles_inside(ttags[WPT_ITALIC], start, end);
+    if (!cs->underline)
+        cs->underline = tag_toggles_inside(ttags[WPT_UNDERLINE], start, end);
+    if (!cs->strikethrough)
+        cs->strikethrough = tag_toggles_inside(ttags[WPT_STRIKE], start, end);
+
+    g_hash_table_iter_init(&hash_iter, buffer->priv->tag_hash);
+    while (g_hash_table_iter_next(&hash_iter, &key, &value))
+    {
+        tag = GTK_TEXT_TAG(key);
+        switch (((WPTagInfo *) value)->category)
         {
-            tag = GTK_TEXT_TAG(tags->data);
-            tags = tags->next;
-
-            // printf("Tag toggle: %p, %s\n", tag, tag->name ? tag->name :
-            // "(null)");
-            if (tag == ttags[WPT_BOLD])
-                cs->bold = TRUE;
-            else if (tag == ttags[WPT_ITALIC])
-                cs->italic = TRUE;
-            else if (tag == ttags[WPT_UNDERLINE])
-                cs->underline = TRUE;
-            else if (tag == ttags[WPT_STRIKE])
-                cs->strikethrough = TRUE;
-            else if (tag == ttags[WPT_BULLET] && !cs->bullet)
-            {
-                if (!fmt->bullet)
-                    cs->bullet = TRUE;
-                else
-                {
-                    line = gtk_text_iter_get_line(&iter);
-                    if (line - bullet_last_line > 1)
-                        cs->bullet = TRUE;
-                    else
-                        bullet_last_line = line;
-                }
-            }
-            else if (tag->rise_set)
-                cs->text_position = TRUE;
-            else if (tag->justification_set)
-                cs->justification = TRUE;
-            else if (tag->fg_color_set)
-                cs->color = TRUE;
-            else if (!cs->font && tag->values->font
-                     && check_tag_type(tag, WPT_FONT, NULL))
-                cs->font = TRUE;
-            else if (!cs->font_size && tag->values->font
-                     && check_tag_type(tag, WPT_FONT_SIZE, NULL))
-                cs->font_size = TRUE;
+            case WPT_CAT_SIMPLE:
+                if (!cs->justification && tag->justification_set)
+                    cs->justification = tag_toggles_inside(tag, start, end);
+                break;
+            case WPT_CAT_SUP_SRPT:
+            case WPT_CAT_SUB_SRPT:
+                if (!cs->text_position)
+                    cs->text_position = tag_toggles_inside(tag, start, end);
+                break;
+            case WPT_CAT_FONT_SIZE:
+                if (!cs->font_size)
+                    cs->font_size = tag_toggles_inside(tag, start, end);
+                break;
+            case WPT_CAT_FONT:
+                if (!cs->font)
+                    cs->font = tag_toggles_inside(tag, start, end);
+                break;
+            case WPT_CAT_COLOR:
+                if (!cs->color)
+                    cs->color = tag_toggles_inside(tag, start, end);
+                break;
         }
-        g_slist_free(tags_head);
-    }
-    if (fmt->bullet && !cs->bullet)
-    {
-        iter = *end;
-        cs->bullet = !_wp_text_iter_has_bullet(&iter, ttags[WPT_BULLET]);
     }
+
+    /* The bullet is toggled if some of the lines differ from the first one
+     * in being a list item */
+    last = gtk_text_iter_get_line(end);
+    for (line = gtk_text_iter_get_line(start); line <= last && !cs->bullet;
+         line++)
+        cs->bullet = !fmt->bullet != !wp_text_buffer_get_list_type(buffer,
+                                                                   line);
 }
 
-static gboolean
-_wp_text_buffer_get_attributes(WPTextBuffer * buffer,
-                               WPTextBufferFormat * fmt,
-                               gboolean set_changed, gboolean parse_selection)
+/**
+ * Resolve the format of the run of characters around <i>tag_place</i>
+ * into the run cache of the <i>buffer</i>. The run is the interval between
+ * the tag toggles around <i>tag_place</i>, so every character in it has the
+ * same tags and the same format. The change set members are set for the
+ * attributes coming from a tag.
+ * @param buffer is a #WPTextBuffer
+ * @param tag_place position of the character which tags are queried
+ */
+static void
+resolve_run_format(WPTextBuffer * buffer, const GtkTextIter * tag_place)
 {
-    GtkTextBuffer *text_buffer;
-    GtkTextIter start, end, tag_place, tmp;
+    WPTextBufferPrivate *priv = buffer->priv;
+    WPTextBufferFormat *fmt = &priv->run_fmt;
+    GtkTextIter run;
     GtkTextTag *tag;
     GtkTextTag **ttags;
     GSList *tags, *tags_head;
-    gboolean selection;
     gint n;
 
-    g_return_val_if_fail(WP_IS_TEXT_BUFFER(buffer), FALSE);
+    run = *tag_place;
+    if (!gtk_text_iter_toggles_tag(&run, NULL))
+        gtk_text_iter_backward_to_tag_toggle(&run, NULL);
+    priv->run_start = gtk_text_iter_get_offset(&run);
+    run = *tag_place;
+    gtk_text_iter_forward_to_tag_toggle(&run, NULL);
+    priv->run_end = gtk_text_iter_get_offset(&run);
+    priv->run_generation = priv->generation;
 
-    if (!fmt)
-        return FALSE;
-
-    // printf("wp_text_buffer_get_attributes\n");
-    text_buffer = GTK_TEXT_BUFFER(buffer);
-    selection = gtk_text_buffer_get_selection_bounds(text_buffer, &start, &end);
-    if(!selection){
-        GtkTextMark *mark;
-        mark = gtk_text_buffer_get_insert(text_buffer);
-        gtk_text_buffer_get_iter_at_mark(text_buffer, &start, mark);
-        tag_place = end = start;
-        gtk_text_iter_backward_char(&tag_place);
-    } else
-        tag_place = start;
- 
-    tags = tags_head = gtk_text_iter_get_tags(&tag_place);
-    ttags = buffer->priv->tags;
+    tags = tags_head = gtk_text_iter_get_tags(tag_place);
+    ttags = priv->tags;
 
     memset(fmt, 0, sizeof(WPTextBufferFormat));
-    fmt->font_size = buffer->priv->default_fmt.font_size;
-    fmt->font = buffer->priv->default_fmt.font;
+    fmt->font_size = priv->default_fmt.font_size;
+    fmt->font = priv->default_fmt.font;
     while (tags)
     {
         tag = GTK_TEXT_TAG(tags->data);
@@ -2868,70 +4206,114 @@ _wp_text_buffer_get_attributes(WPTextBuffer * buffer,
         if (tag == ttags[WPT_BOLD])
         {
             fmt->bold = TRUE;
-            fmt->cs.bold = set_changed;
+            fmt->cs.bold = TRUE;
         }
         else if (tag == ttags[WPT_ITALIC])
         {
             fmt->italic = TRUE;
-            fmt->cs.italic = set_changed;
+            fmt->cs.italic = TRUE;
         }
         else if (tag == ttags[WPT_UNDERLINE])
         {
             fmt->underline = TRUE;
-            fmt->cs.underline = set_changed;
+            fmt->cs.underline = TRUE;
         }
         else if (tag == ttags[WPT_STRIKE])
         {
             fmt->strikethrough = TRUE;
-            fmt->cs.strikethrough = set_changed;
+            fmt->cs.strikethrough = TRUE;
         }
         else if (tag->rise_set)
         {
-            n = GPOINTER_TO_INT (g_object_get_data(G_OBJECT(tag), WPT_ID));
-            if (n >= WPT_SUB_SRPT)
+            if (check_tag_type(buffer->priv, tag, WPT_CAT_SUB_SRPT, &n))
             {
                 fmt->text_position = TEXT_POSITION_SUBSCRIPT;
-                fmt->font_size = n - WPT_SUB_SRPT;
+                fmt->font_size = n;
             }
-            else if (n >= WPT_SUP_SRPT)
+            else if (check_tag_type(buffer->priv, tag, WPT_CAT_SUP_SRPT, &n))
             {
                 fmt->text_position = TEXT_POSITION_SUPERSCRIPT;
-                fmt->font_size = n - WPT_SUP_SRPT;
+                fmt->font_size = n;
             }
             else
                 continue;
 
-            fmt->cs.text_position = set_changed;
-            fmt->cs.font_size = set_changed;
+            fmt->cs.text_position = TRUE;
+            fmt->cs.font_size = TRUE;
         }
         else if (tag->justification_set)
-        {
-            fmt->justification =
-                tag == ttags[WPT_LEFT] ? GTK_JUSTIFY_LEFT : tag ==
-                ttags[WPT_CENTER] ? GTK_JUSTIFY_CENTER : GTK_JUSTIFY_RIGHT;
-            fmt->cs.justification = set_changed;
-        }
+            /* A paragraph attribute, taken from the paragraph table */
+            continue;
         else if (tag->fg_color_set)
         {
             fmt->color = tag->values->appearance.fg_color;
-            fmt->cs.color = set_changed;
+            fmt->cs.color = TRUE;
         }
-        else if (tag->values->font && check_tag_type(tag, WPT_FONT, &n))
+        else if (tag->values->font
+                 && check_tag_type(buffer->priv, tag, WPT_CAT_FONT, &n))
         {
             fmt->font = n;
-            fmt->cs.font = set_changed;
+            fmt->cs.font = TRUE;
         }
-        else if (tag->values->font && check_tag_type(tag, WPT_FONT_SIZE, &n))
+        else if (tag->values->font
+                 && check_tag_type(buffer->priv, tag, WPT_CAT_FONT_SIZE, &n))
         {
             fmt->font_size = n;
-            fmt->cs.text_position = set_changed;
-            fmt->cs.font_size = set_changed;
+            fmt->cs.text_position = TRUE;
+            fmt->cs.font_size = TRUE;
         }
     }
     g_slist_free(tags_head);
+}
+
+static gboolean
+_wp_text_buffer_get_attributes(WPTextBuffer * buffer,
+                               WPTextBufferFormat * fmt,
+                               gboolean set_changed, gboolean parse_selection)
+{
+    GtkTextBuffer *text_buffer;
+    WPTextBufferPrivate *priv;
+    GtkTextIter start, end, tag_place;
+    const WPParagraph *paragraph;
+    gboolean selection;
+    gint offset;
+
+    g_return_val_if_fail(WP_IS_TEXT_BUFFER(buffer), FALSE);
+
+    if (!fmt)
+        return FALSE;
 
-    tmp = start; /*iter will be modifyed by asking for bullet*/
-    fmt->bullet = _wp_text_iter_has_bullet(&tmp, ttags[WPT_BULLET]);
+    // printf("wp_text_buffer_get_attributes\n");
+    text_buffer = GTK_TEXT_BUFFER(buffer);
+    selection = gtk_text_buffer_get_selection_bounds(text_buffer, &start, &end);
+    if(!selection){
+        GtkTextMark *mark;
+        mark = gtk_text_buffer_get_insert(text_buffer);
+        gtk_text_buffer_get_iter_at_mark(text_buffer, &start, mark);
+        tag_place = end = start;
+        gtk_text_iter_backward_char(&tag_place);
+    } else
+        tag_place = start;
+ 
+    priv = buffer->priv;
+
+    offset = gtk_text_iter_get_offset(&tag_place);
+    if (priv->run_generation != priv->generation ||
+        offset < priv->run_start || offset >= priv->run_end)
+        resolve_run_format(buffer, &tag_place);
+
+    *fmt = priv->run_fmt;
+    if (!set_changed)
+        changeset_clear(&fmt->cs);
+
+    paragraph = get_paragraph(buffer, gtk_text_iter_get_line(&start));
+    fmt->bullet = paragraph->list != WP_LIST_NONE;
+    if (paragraph->justification)
+    {
+        fmt->justification =
+            paragraph->justification->values->justification;
+        fmt->cs.justification = set_changed;
+    }
 
     if (gtk_text_iter_is_end(&end))
         fmt->justification = buffer->priv->last_line_justification;
@@ -2953,7 +4335,9 @@ wp_text_buffer_get_attributes(WPTextBuffer * buffer,
 
     if (buffer->priv->is_empty)
     {
-        buffer->priv->fmt.bullet = FALSE;
+        /* An empty buffer can still have a bullet on its only line */
+        buffer->priv->fmt.bullet =
+            get_paragraph(buffer, 0)->list != WP_LIST_NONE;
         *fmt = buffer->priv->fmt;
         changeset_clear(&fmt->cs);
     }
@@ -3000,150 +4384,396 @@ wp_text_buffer_get_current_state(WPTextBuffer * buffer,
  * Bullets
  */
 
-gboolean
-_wp_text_iter_is_bullet(GtkTextIter * iter, GtkTextTag * tag)
+/**
+ * Add <i>delta</i> to the number of the list lines. The list_changed signal
+ * is sent when the buffer gets its first or loses its last list item.
+ * @param buffer pointer to a #WPTextBuffer
+ * @param delta is the change of the number of the list lines
+ */
+static void
+add_list_lines(WPTextBuffer * buffer, gint delta)
+{
+    WPTextBufferPrivate *priv = buffer->priv;
+    gboolean had_lists = priv->list_lines > 0;
+
+    priv->list_lines += delta;
+    if (had_lists != (priv->list_lines > 0))
+        g_signal_emit(buffer, signals[LIST_CHANGED], 0,
+                      priv->list_lines > 0);
+}
+
+static const WPParagraph *
+get_paragraph(WPTextBuffer * buffer, gint line)
+{
+    WPTextBufferPrivate *priv = buffer->priv;
+    GtkTextBuffer *text_buffer = GTK_TEXT_BUFFER(buffer);
+    WPParagraph *paragraph;
+    GtkTextIter iter;
+    GSList *tags;
+    gint count = gtk_text_buffer_get_line_count(text_buffer);
+    gint i, lists;
+
+    /* Called from a changed handler, before the hook got back the control */
+    update_paragraphs(buffer);
+
+    /* A change has been missed by the hooks, the justifications are looked
+     * up again, the list types of the remaining lines are kept */
+    if (priv->paragraphs->len != (guint) count)
+    {
+        g_array_set_size(priv->paragraphs, count);
+        for (i = lists = 0; i < count; i++)
+        {
+            paragraph = &g_array_index(priv->paragraphs, WPParagraph, i);
+            paragraph->valid = FALSE;
+            paragraph->number = 0;
+            lists += paragraph->list != WP_LIST_NONE;
+        }
+        add_list_lines(buffer, lists - priv->list_lines);
+    }
+
+    line = CLAMP(line, 0, count - 1);
+    paragraph = &g_array_index(priv->paragraphs, WPParagraph, line);
+    if (!paragraph->valid)
+    {
+        gtk_text_buffer_get_iter_at_line(text_buffer, &iter, line);
+        tags = gtk_text_iter_get_tags(&iter);
+        paragraph->justification = find_justification_tag(tags, FALSE);
+        g_slist_free(tags);
+        paragraph->valid = TRUE;
+    }
+
+    return paragraph;
+}
+
+/**
+ * Forget the computed list numbers from <i>first</i> to <i>last</i>, and
+ * after <i>last</i> till the end of the numbered list
+ * @param priv is a pointer to #WPTextBufferPrivate
+ * @param first is the first line to forget
+ * @param last is the last line which is surely affected
+ */
+static void
+clear_list_numbers(WPTextBufferPrivate * priv, gint first, gint last)
+{
+    GArray *paragraphs = priv->paragraphs;
+    WPParagraph *paragraph;
+    gint line;
+
+    for (line = MAX(first, 0); line < (gint) paragraphs->len; line++)
+    {
+        paragraph = &g_array_index(paragraphs, WPParagraph, line);
+        if (line > last && !paragraph->number)
+            break;
+        paragraph->number = 0;
+    }
+}
+
+/**
+ * Get the number of a numbered list item. Only the items before it in the
+ * same list, without a computed number, are visited.
+ * @param buffer pointer to a #WPTextBuffer
+ * @param line is a line number in the buffer
+ * @return the number of the item, or 0 if the line is not part of a
+ *         numbered list
+ */
+static gint
+get_list_number(WPTextBuffer * buffer, gint line)
 {
-    return gtk_text_iter_has_tag(iter, tag);
+    GArray *paragraphs = buffer->priv->paragraphs;
+    const WPParagraph *paragraph = get_paragraph(buffer, line);
+    guint list = paragraph->list;
+    gint first, number = 0;
+
+    if (list < WP_LIST_NUMBER)
+        return 0;
+    if (paragraph->number)
+        return paragraph->number;
+
+    for (first = line; first > 0; first--)
+    {
+        paragraph = get_paragraph(buffer, first - 1);
+        if (paragraph->list != list)
+            break;
+        if (paragraph->number)
+        {
+            number = paragraph->number;
+            break;
+        }
+    }
+
+    for (; first <= line; first++)
+        g_array_index(paragraphs, WPParagraph, first).number = ++number;
+
+    return number;
 }
 
+static void
+begin_paragraph_change(WPTextBufferPrivate * priv, gint line,
+                       gboolean line_start)
+{
+    priv->paragraph_change = line;
+    priv->paragraph_change_start = line_start;
+}
 
-gboolean
-_wp_text_iter_skip_bullet(GtkTextIter * iter, GtkTextTag * tag,
-                          gboolean forward)
+static void
+update_paragraphs(WPTextBuffer * buffer)
 {
-    gboolean result;
-    if ((result = gtk_text_iter_has_tag(iter, tag)))
+    WPTextBufferPrivate *priv = buffer->priv;
+    GArray *paragraphs = priv->paragraphs;
+    guint len = paragraphs->len;
+    gint line = priv->paragraph_change;
+    gboolean line_start = priv->paragraph_change_start;
+    gint lines, list, delta = 0;
+    gint i;
+
+    if (line < 0)
+        return;
+    priv->paragraph_change = -1;
+    if (line >= (gint) len)
+        return;
+
+    lines = gtk_text_buffer_get_line_count(GTK_TEXT_BUFFER(buffer)) - len;
+    list = g_array_index(paragraphs, WPParagraph, line).list;
+
+    if (lines > 0)
     {
-        if (forward)
+        g_array_set_size(paragraphs, len + lines);
+        memmove(&g_array_index(paragraphs, WPParagraph, line + 1 + lines),
+                &g_array_index(paragraphs, WPParagraph, line + 1),
+                (len - line - 1) * sizeof(WPParagraph));
+        memset(&g_array_index(paragraphs, WPParagraph, line + 1), 0,
+               lines * sizeof(WPParagraph));
+
+        /* The new lines continue the list of the split line */
+        if (list != WP_LIST_NONE)
         {
-            if (!gtk_text_iter_ends_tag(iter, tag))
-                gtk_text_iter_forward_to_tag_toggle(iter, tag);
-            /* while (!gtk_text_iter_ends_tag(iter, tag))
-             * gtk_text_iter_forward_char(iter); */
+            for (i = 1; i <= lines; i++)
+                g_array_index(paragraphs, WPParagraph, line + i).list = list;
+            delta = lines;
         }
-        else
+    }
+    else if (lines < 0)
+    {
+        lines = MAX(lines, line + 1 - (gint) len);
+        for (i = line + 1; i <= line - lines; i++)
+            if (g_array_index(paragraphs, WPParagraph, i).list !=
+                WP_LIST_NONE)
+                delta--;
+
+        /* Nothing is left from the first line, the joined line is the rest
+         * of the last removed one */
+        if (line_start && lines < 0)
         {
-            if (!gtk_text_iter_begins_tag(iter, tag))
-                gtk_text_iter_backward_to_tag_toggle(iter, tag);
-            /* while (!gtk_text_iter_begins_tag(iter, tag))
-             * gtk_text_iter_backward_char(iter); */
+            delta -= list != WP_LIST_NONE;
+            list = g_array_index(paragraphs, WPParagraph, line - lines).list;
+            g_array_index(paragraphs, WPParagraph, line).list = list;
+            delta += list != WP_LIST_NONE;
         }
+
+        if (lines < 0)
+            g_array_remove_range(paragraphs, line + 1, -lines);
     }
-    return result;
+
+    if (line_start)
+        g_array_index(paragraphs, WPParagraph, line).valid = FALSE;
+
+    /* The following items of a numbered list are numbered again */
+    if (lines || line_start)
+        clear_list_numbers(priv, line_start ? line : line + 1,
+                           line + 1 + MAX(lines, 0));
+
+    add_list_lines(buffer, delta);
 }
 
-gboolean
-_wp_text_iter_has_bullet(GtkTextIter * iter, GtkTextTag * tag)
+static void
+invalidate_paragraphs(WPTextBufferPrivate * priv, GtkTextTag * tag,
+                      const GtkTextIter * start, const GtkTextIter * end)
 {
-    if (!gtk_text_iter_starts_line(iter))
-        gtk_text_iter_set_line_offset(iter, 0);
+    gint line, last;
 
-    // return _wp_text_iter_is_bullet(iter, tag);
-    return gtk_text_iter_toggles_tag(iter, tag);
+    if (!tag->justification_set)
+        return;
+
+    line = gtk_text_iter_get_line(start);
+    last = MIN(gtk_text_iter_get_line(end), (gint) priv->paragraphs->len - 1);
+    for (; line <= last; line++)
+        g_array_index(priv->paragraphs, WPParagraph, line).valid = FALSE;
 }
 
-gboolean
-_wp_text_iter_put_bullet_line(GtkTextIter * iter, GtkTextTag * tag)
+/**
+ * Format <i>number</i> as a letter label: a, b, ..., z, aa, ab, ...
+ * @param number is a positive number
+ * @param first is the first letter, 'a' or 'A'
+ * @return the newly allocated label, followed by a dot
+ */
+static gchar *
+alpha_list_label(gint number, gchar first)
 {
-    gboolean result;
+    gchar label[16];
+    gint i = sizeof(label) - 1;
 
-    if ((result = !_wp_text_iter_has_bullet(iter, tag)))
+    label[i] = 0;
+    label[--i] = '.';
+    while (number > 0 && i > 0)
     {
-        GtkTextBuffer *buffer = gtk_text_iter_get_buffer(iter);
-        WP_TEXT_BUFFER(buffer)->priv->force_copy = TRUE;
-        gtk_text_buffer_insert_with_tags(buffer,
-                                         iter, "\xe2\x80\xa2\xc2\xa0\xc2\xa0",
-                                         -1, tag, NULL);
+        number--;
+        label[--i] = first + number % 26;
+        number /= 26;
+    }
+
+    return g_strdup(label + i);
+}
+
+gchar *
+_wp_text_buffer_get_list_label(WPTextBuffer * buffer, gint line)
+{
+    gint number;
+
+    g_return_val_if_fail(WP_IS_TEXT_BUFFER(buffer), NULL);
+
+    if (!(number = get_list_number(buffer, line)))
+        return NULL;
+
+    switch (get_paragraph(buffer, line)->list)
+    {
+        case WP_LIST_LOWER_ALPHA:
+            return alpha_list_label(number, 'a');
+        case WP_LIST_UPPER_ALPHA:
+            return alpha_list_label(number, 'A');
+        default:
+            return g_strdup_printf("%d.", number);
     }
-    return result;
 }
 
 void
-_wp_text_iter_remove_bullet_line(GtkTextIter * iter, GtkTextTag * tag)
+_wp_text_buffer_set_list_types(WPTextBuffer * buffer, gint first,
+                               const guint8 * types, gint count)
 {
-    GtkTextIter end;
+    WPTextBufferPrivate *priv;
+    WPParagraph *paragraph;
+    guint8 *orig_types;
+    gboolean changed = FALSE;
+    gint i, delta = 0;
+
+    g_return_if_fail(WP_IS_TEXT_BUFFER(buffer));
+
+    priv = buffer->priv;
+    get_paragraph(buffer, first);
+    count = MIN(count, (gint) priv->paragraphs->len - first);
+    if (first < 0 || count <= 0)
+        return;
+
+    orig_types = g_new(guint8, count);
+    for (i = 0; i < count; i++)
+    {
+        paragraph = &g_array_index(priv->paragraphs, WPParagraph, first + i);
+        orig_types[i] = paragraph->list;
+        if (paragraph->list == types[i])
+            continue;
+
+        delta += (types[i] != WP_LIST_NONE) -
+            (paragraph->list != WP_LIST_NONE);
+        paragraph->list = types[i];
+        changed = TRUE;
+    }
 
-    if (_wp_text_iter_has_bullet(iter, tag))
+    if (changed)
     {
-        end = *iter;
-        _wp_text_iter_skip_bullet(&end, tag, TRUE);
-        gtk_text_buffer_delete(gtk_text_iter_get_buffer(iter), iter, &end);
+        wp_undo_list_types(priv->undo, first, count, orig_types, types);
+        clear_list_numbers(priv, first, first + count - 1);
+        priv->list_lines += delta;
+        g_signal_emit(buffer, signals[LIST_CHANGED], 0, priv->list_lines > 0);
+        if (!priv->fast_mode)
+            gtk_text_buffer_set_modified(GTK_TEXT_BUFFER(buffer), TRUE);
     }
+
+    g_free(orig_types);
+}
+
+void
+_wp_text_buffer_set_line_list_type(WPTextBuffer * buffer, gint line,
+                                   WPListType type)
+{
+    guint8 types[1] = { type };
+
+    _wp_text_buffer_set_list_types(buffer, line, types, 1);
 }
 
+/**
+ * Set the list type of the selected lines, or the line of the cursor
+ * @param buffer pointer to a #WPTextBuffer
+ * @param type is a #WPListType
+ * @param keep_lists is <b>TRUE</b> if the list items keep their own type,
+ *                   only the other lines get <i>type</i>
+ */
 static void
-_wp_text_buffer_put_bullet(WPTextBuffer * buffer)
+set_selection_list_type(WPTextBuffer * buffer, WPListType type,
+                        gboolean keep_lists)
 {
-    GtkTextIter iter, start, end;
-    GtkTextTag *bullet = _wp_text_buffer_get_bullet_tag(buffer);
     GtkTextBuffer *text_buffer = GTK_TEXT_BUFFER(buffer);
-    gint count;
+    GtkTextIter start, end;
+    guint8 *types;
+    gint first, count, i;
 
-    freeze_cursor_moved(buffer);
+    gtk_text_buffer_get_selection_bounds(text_buffer, &start, &end);
+    first = gtk_text_iter_get_line(&start);
+    count = gtk_text_iter_get_line(&end) - first + 1;
 
-    gtk_text_buffer_begin_user_action(text_buffer);
-    if (gtk_text_buffer_get_selection_bounds(text_buffer, &start, &end))
-    {
-        iter = start;
-        count = gtk_text_iter_get_line(&end) - gtk_text_iter_get_line(&start);
-        while (count-- >= 0)
-        {
-            _wp_text_iter_put_bullet_line(&iter, bullet);
-            if (!gtk_text_iter_forward_line(&iter))
-                break;
-        }
-    }
-    else
+    types = g_new(guint8, count);
+    for (i = 0; i < count; i++)
     {
-        /* gtk_text_buffer_get_iter_at_mark (text_buffer, &iter,
-         * gtk_text_buffer_get_insert (text_buffer)); */
-        _wp_text_iter_put_bullet_line(&start, bullet);
+        types[i] = keep_lists ?
+            wp_text_buffer_get_list_type(buffer, first + i) : WP_LIST_NONE;
+        if (types[i] == WP_LIST_NONE)
+            types[i] = type;
     }
+
+    gtk_text_buffer_begin_user_action(text_buffer);
+    _wp_text_buffer_set_list_types(buffer, first, types, count);
     gtk_text_buffer_end_user_action(text_buffer);
+    g_free(types);
+
+    emit_refresh_signals(buffer);
+}
+
+void
+wp_text_buffer_set_list_type(WPTextBuffer * buffer, WPListType type)
+{
+    g_return_if_fail(WP_IS_TEXT_BUFFER(buffer));
+    g_return_if_fail(type < WP_LIST_LAST);
+
+    set_selection_list_type(buffer, type, FALSE);
+}
 
-    thaw_cursor_moved(buffer);
+WPListType
+wp_text_buffer_get_list_type(WPTextBuffer * buffer, gint line)
+{
+    g_return_val_if_fail(WP_IS_TEXT_BUFFER(buffer), WP_LIST_NONE);
+
+    return get_paragraph(buffer, line)->list;
 }
 
+static void
+_wp_text_buffer_put_bullet(WPTextBuffer * buffer)
+{
+    set_selection_list_type(buffer, WP_LIST_BULLET, TRUE);
+}
 
 static void
 _wp_text_buffer_remove_bullet(WPTextBuffer * buffer)
 {
-    GtkTextIter iter, start, end;
-    GtkTextTag *bullet = _wp_text_buffer_get_bullet_tag(buffer);
-    GtkTextBuffer *text_buffer = GTK_TEXT_BUFFER(buffer);
-    gint count;
-
-    freeze_cursor_moved(buffer);
-
-    gtk_text_buffer_begin_user_action(text_buffer);
-    if (gtk_text_buffer_get_selection_bounds(text_buffer, &start, &end))
-    {
-        iter = start;
-        count = gtk_text_iter_get_line(&end) - gtk_text_iter_get_line(&start);
-        while (count-- >= 0)
-        {
-            _wp_text_iter_remove_bullet_line(&iter, bullet);
-            if (!gtk_text_iter_forward_line(&iter))
-                break;
-        }
-    }
-    else
-    {
-        /* gtk_text_buffer_get_iter_at_mark (text_buffer, &iter,
-         * gtk_text_buffer_get_insert (text_buffer)); */
-        _wp_text_iter_remove_bullet_line(&start, bullet);
-    }
-    gtk_text_buffer_end_user_action(text_buffer);
-
-    thaw_cursor_moved(buffer);
+    set_selection_list_type(buffer, WP_LIST_NONE, FALSE);
 }
 
-GtkTextTag *
-_wp_text_buffer_get_bullet_tag(WPTextBuffer * buffer)
+const gchar *
+_wp_text_buffer_get_image_id(WPTextBuffer * buffer, GtkTextTag * tag)
 {
+    WPTagInfo *info;
+
     g_return_val_if_fail(WP_IS_TEXT_BUFFER(buffer), NULL);
 
-    return WP_TEXT_BUFFER(buffer)->priv->tags[WPT_BULLET];
+    info = lookup_tag_info(buffer->priv, tag);
+    return info && info->category == WPT_CAT_IMAGE ? info->image_id : NULL;
 }
 
 void
@@ -3152,7 +4782,7 @@ wp_text_buffer_undo(WPTextBuffer * buffer)
     g_return_if_fail(WP_IS_TEXT_BUFFER(buffer));
 
     wp_undo_undo(buffer->priv->undo);
-    g_signal_emit(buffer, signals[REFRESH_ATTRIBUTES], 0);
+    emit_refresh_signals(buffer);
 }
 
 void
@@ -3161,7 +4791,7 @@ wp_text_buffer_redo(WPTextBuffer * buffer)
     g_return_if_fail(WP_IS_TEXT_BUFFER(buffer));
 
     wp_undo_redo(buffer->priv->undo);
-    g_signal_emit(buffer, signals[REFRESH_ATTRIBUTES], 0);
+    emit_refresh_signals(buffer);
 }
 
 
@@ -3203,6 +4833,44 @@ wp_text_buffer_no_memory_cb(WPUndo * undo, WPTextBuffer * buffer)
     g_signal_emit(buffer, signals[NO_MEMORY], 0);
 }
 
+/**
+ * Check if <i>ch</i> is an image
+ * @param ch is a unicode character
+ * @param user_data is not used
+ * @return <b>TRUE</b> if it is an object replacement character
+ */
+static gboolean
+is_image_char(gunichar ch, gpointer user_data)
+{
+    return ch == 0xFFFC;
+}
+
+/**
+ * Collect the offsets of the images, which has no meaning in plain text
+ * @param text_buffer is a #GtkTextBuffer
+ * @return a #GArray of gint, holding the offsets in increasing order
+ */
+static GArray *
+collect_image_chars(GtkTextBuffer * text_buffer)
+{
+    GArray *offsets = g_array_new(FALSE, FALSE, sizeof(gint));
+    GtkTextIter iter;
+    gint offset;
+
+    gtk_text_buffer_get_start_iter(text_buffer, &iter);
+    if (!is_image_char(gtk_text_iter_get_char(&iter), NULL))
+        gtk_text_iter_forward_find_char(&iter, is_image_char, NULL, NULL);
+
+    while (!gtk_text_iter_is_end(&iter))
+    {
+        offset = gtk_text_iter_get_offset(&iter);
+        g_array_append_val(offsets, offset);
+        gtk_text_iter_forward_find_char(&iter, is_image_char, NULL, NULL);
+    }
+
+    return offsets;
+}
+
 void
 wp_text_buffer_enable_rich_text(WPTextBuffer * buffer, gboolean enable)
 {
@@ -3229,52 +4897,29 @@ wp_text_buffer_enable_rich_text(WPTextBuffer * buffer, gboolean enable)
         }
         else
         {
-            GtkTextIter found1, found2, found3;
-            gint foundbackup;
-
-            gtk_text_buffer_get_start_iter(text_buffer, &start);
-
-            // Change the unicode char of the bullets to " * "
-            while (gtk_text_iter_forward_search
-                   (&start, "\xe2\x80\xa2\xc2\xa0\xc2\xa0", 0, &found1,
-                    &found2, NULL))
-            {
-
-                // delete the unicode character
-                foundbackup = gtk_text_iter_get_offset(&found1);
-                gtk_text_buffer_delete(text_buffer, &found1, &found2);
-
-                // Re-initialize the iterator
-                gtk_text_buffer_get_start_iter(text_buffer, &found1);
-                gtk_text_buffer_get_iter_at_offset(text_buffer, &found3,
-                                                   foundbackup);
-
-                // Insert the new text
-                // gtk_text_buffer_insert (text_buffer, &found3, " * ", 3);
-
-                gtk_text_buffer_get_iter_at_offset(text_buffer, &start,
-                                                   foundbackup);
-            }
-
-            gtk_text_buffer_get_start_iter(text_buffer, &start);
-
-            // Remove all the images
-            while (gtk_text_iter_forward_search
-                   (&start, "\xef\xbf\xbc", 0, &found1, &found2, NULL))
+            GArray *offsets;
+            guint8 *types;
+            gint i, count;
+
+            /* The bullets are only in the paragraph table */
+            count = gtk_text_buffer_get_line_count(text_buffer);
+            types = g_new0(guint8, count);
+            _wp_text_buffer_set_list_types(buffer, 0, types, count);
+            g_free(types);
+
+            /* Remove the images in one pass, deleting them from the end, so
+             * the collected offsets stay valid */
+            offsets = collect_image_chars(text_buffer);
+            for (i = (gint) offsets->len - 1; i >= 0; i--)
             {
-
-                // delete the unicode character
-                foundbackup = gtk_text_iter_get_offset(&found1);
-                gtk_text_buffer_delete(text_buffer, &found1, &found2);
-
-                // Re-initialize the iterator
-                gtk_text_buffer_get_start_iter(text_buffer, &found1);
-                gtk_text_buffer_get_iter_at_offset(text_buffer, &found3,
-                                                   foundbackup);
-
                 gtk_text_buffer_get_iter_at_offset(text_buffer, &start,
-                                                   foundbackup);
+                                                   g_array_index(offsets,
+                                                                 gint, i));
+                end = start;
+                gtk_text_iter_forward_char(&end);
+                gtk_text_buffer_delete(text_buffer, &start, &end);
             }
+            g_array_free(offsets, TRUE);
 
             wp_undo_freeze(priv->undo);
             gtk_text_buffer_get_start_iter(text_buffer, &start);
@@ -3286,7 +4931,7 @@ wp_text_buffer_enable_rich_text(WPTextBuffer * buffer, gboolean enable)
             emit_default_justification_changed(buffer, GTK_JUSTIFY_LEFT);
         }
         g_signal_emit(buffer, signals[FMT_CHANGED], 0, enable);
-        g_signal_emit(buffer, signals[REFRESH_ATTRIBUTES], 0);
+        emit_refresh_signals(buffer);
         emit_default_font_changed(buffer);
         
         /* Only mark modified if there is content in text buffer */
@@ -3318,13 +4963,88 @@ wp_text_buffer_is_modified(WPTextBuffer * buffer)
     return gtk_text_buffer_get_modified(GTK_TEXT_BUFFER(buffer));
 }
 
+static const WPSizeTable *
+get_size_table(WPTagSet * set, double scale)
+{
+    WPSizeTable sizes;
+    gint i, font_size;
+
+    for (i = 0; i < set->n_size_tables; i++)
+        if (set->size_tables[i].scale == scale)
+            break;
+
+    if (i < set->n_size_tables)
+        sizes = set->size_tables[i];
+    else
+    {
+        if (i == SIZE_TABLE_CACHE)
+            i--;
+        else
+            set->n_size_tables++;
+
+        sizes.scale = scale;
+        for (font_size = 0; font_size < WP_FONT_SIZE_COUNT; font_size++)
+        {
+            gdouble size = scale * wp_font_size[font_size] * PANGO_SCALE;
+
+            sizes.size[font_size] = iround(size);
+            sizes.sup_sub_size[font_size] =
+                iround((size * SUP_SUB_SIZE_MULT) / SUP_SUB_SIZE_DIV);
+            sizes.sup_rise[font_size] =
+                iround((size * SUP_RISE_MULT) / SUP_RISE_DIV);
+            sizes.sub_rise[font_size] =
+                -iround((size * SUB_RISE_MULT) / SUB_RISE_DIV);
+        }
+    }
+
+    /* Keep the most recently used on the front */
+    memmove(&set->size_tables[1], &set->size_tables[0],
+            i * sizeof(WPSizeTable));
+    set->size_tables[0] = sizes;
+
+    return &set->size_tables[0];
+}
+
+static void
+set_size_tag_attributes(GtkTextTag * tag, WPTagCategory category,
+                        gint index, const WPSizeTable * sizes)
+{
+    gint size, rise;
+    gboolean set_size, set_rise;
+
+    if (category == WPT_CAT_FONT_SIZE)
+    {
+        /* Normal size */
+        size = sizes->size[index];
+        rise = 0;
+    }
+    else
+    {
+        size = sizes->sup_sub_size[index];
+        rise = category == WPT_CAT_SUP_SRPT ?
+            sizes->sup_rise[index] : sizes->sub_rise[index];
+    }
+
+    set_size = tag->values->font == NULL ||
+        pango_font_description_get_size(tag->values->font) != size;
+    set_rise = category != WPT_CAT_FONT_SIZE &&
+        (!tag->rise_set || tag->values->appearance.rise != rise);
+
+    if (set_size && set_rise)
+        g_object_set(G_OBJECT(tag), "size", size, "rise", rise, NULL);
+    else if (set_size)
+        g_object_set(G_OBJECT(tag), "size", size, NULL);
+    else if (set_rise)
+        g_object_set(G_OBJECT(tag), "rise", rise, NULL);
+}
+
 static void
 wp_text_buffer_resize_font(WPTextBuffer * buffer)
 {
-    gint i;
-    gint font_size;
-    gint actual_size;
-    gint rise;
+    GtkTextTag *tags[WP_FONT_SIZE_COUNT * 3];
+    const WPSizeTable *sizes;
+    WPTagInfo *info;
+    gint i, n = 0;
     WPTextBufferPrivate *priv = buffer->priv;
     double scale = priv->font_scaling_factor;
 
@@ -3333,30 +5053,22 @@ wp_text_buffer_resize_font(WPTextBuffer * buffer)
     else
         priv->font_scaling_factor = scale;
 
+    /* Only the already created tags has to be resized */
     for (i = 0; i < WP_FONT_SIZE_COUNT; i++)
     {
-        /* Normal size */
-        font_size = wp_font_size[i];
-        actual_size = iround(scale * font_size * PANGO_SCALE);
-        g_object_set(G_OBJECT(priv->font_size_tags[i]),
-                     "size", actual_size, NULL);
-
-        /* Superscript size */
-        actual_size = iround((scale * font_size *
-                              PANGO_SCALE * SUP_SUB_SIZE_MULT) /
-                             SUP_SUB_SIZE_DIV);
-        rise =
-            iround((scale * font_size * PANGO_SCALE *
-                    SUP_RISE_MULT) / SUP_RISE_DIV);
-        g_object_set(G_OBJECT(priv->font_size_sup_tags[i]),
-                     "rise", rise, "size", actual_size, NULL);
-
-        /* Subscript size */
-        rise =
-            -iround((scale * font_size * PANGO_SCALE *
-                     SUB_RISE_MULT) / SUB_RISE_DIV);
-        g_object_set(G_OBJECT(priv->font_size_sub_tags[i]),
-                     "rise", rise, "size", actual_size, NULL);
+        if (priv->font_size_tags[i])
+            tags[n++] = priv->font_size_tags[i];
+        if (priv->font_size_sup_tags[i])
+            tags[n++] = priv->font_size_sup_tags[i];
+        if (priv->font_size_sub_tags[i])
+            tags[n++] = priv->font_size_sub_tags[i];
+    }
+
+    sizes = get_size_table(priv->tag_set, scale);
+    for (i = 0; i < n; i++)
+    {
+        info = lookup_tag_info(priv, tags[i]);
+        set_size_tag_attributes(tags[i], info->category, info->index, sizes);
     }
 }
 
@@ -3371,7 +5083,7 @@ wp_text_buffer_set_font_scaling_factor(WPTextBuffer * buffer, double scale)
         emit_default_font_changed(buffer);
 
         // If the fonts tags are created, resize them
-        if (priv->font_size_tags[0])
+        if (priv->font_size_tags)
             wp_text_buffer_resize_font(buffer);
     }
 }
@@ -3475,18 +5187,21 @@ wp_text_buffer_reset_buffer(WPTextBuffer * buffer, gboolean rich_text)
     wp_undo_freeze(priv->undo);
 
     gtk_text_buffer_set_text(text_buffer, "", -1);
+    /* The remaining line takes the list type of the deleted last line */
+    _wp_text_buffer_set_line_list_type(buffer, 0, WP_LIST_NONE);
     gtk_text_buffer_set_modified(text_buffer, FALSE);
     priv->fmt = priv->default_fmt;
 
     g_object_set(G_OBJECT(buffer), "rich_text", rich_text, NULL);
     g_object_set(G_OBJECT(buffer), "background_color", NULL, NULL);
     wp_undo_reset(priv->undo);
+    wp_text_buffer_collect_tags(buffer);
 
     emit_default_font_changed(buffer);
     emit_default_justification_changed(buffer, GTK_JUSTIFY_LEFT);
 
     if (!priv->fast_mode)
-        g_signal_emit(G_OBJECT(buffer), signals[REFRESH_ATTRIBUTES], 0);
+        emit_refresh_signals(buffer);
 
     wp_undo_thaw(priv->undo);
 }
@@ -3610,8 +5325,6 @@ wp_text_buffer_load_document_end(WPTextBuffer * buffer)
     text_buffer = GTK_TEXT_BUFFER(buffer);
 
     gtk_text_buffer_get_start_iter(text_buffer, &pos);
-    if (buffer->priv->is_rich_text)
-        _wp_text_iter_skip_bullet(&pos, buffer->priv->tags[WPT_BULLET], TRUE);
     gtk_text_buffer_place_cursor(text_buffer, &pos);
     gtk_text_buffer_set_modified(text_buffer, FALSE);
     buffer->priv->cursor_moved = FALSE;
@@ -3622,7 +5335,7 @@ wp_text_buffer_load_document_end(WPTextBuffer * buffer)
     changeset_clear(&buffer->priv->fmt.cs);
 
     emit_default_justification_changed(buffer, last_line_justification);
-    g_signal_emit(buffer, signals[REFRESH_ATTRIBUTES], 0);
+    emit_refresh_signals(buffer);
 }
 
 /**********************************************
@@ -3763,16 +5476,18 @@ encode_text(GtkTextIter * start,
 
 /**
  * Get's the <i>tag</i> id, and parameters (ex. font size or color)
- * @param pointer to an array of #GtkTextTag
+ * @param priv is a pointer to #WPTextBufferPrivate
  * @param tag is a #GtkTextTag
  * @param id will contain the font size or font number if needed
  * @param color will contain the color if needed
  * @return the id of the tag
  */
 static gint
-convert_tag(GtkTextTag ** ttags, GtkTextTag * tag, gint * id,
+convert_tag(WPTextBufferPrivate * priv, GtkTextTag * tag, gint * id,
             GdkColor * color)
 {
+    GtkTextTag **ttags = priv->tags;
+
     if (tag == ttags[WPT_BOLD])
         return TP_BOLD;
     else if (tag == ttags[WPT_ITALIC])
@@ -3783,26 +5498,20 @@ convert_tag(GtkTextTag ** ttags, GtkTextTag * tag, gint * id,
         return TP_STRIKE;
     else if (tag->rise_set)
     {
-	*id = GPOINTER_TO_INT (g_object_get_data(G_OBJECT(tag), WPT_ID));
-        if (*id >= WPT_SUB_SRPT)
-        {
-            *id -= WPT_SUB_SRPT;
+        if (check_tag_type(priv, tag, WPT_CAT_SUB_SRPT, id))
             return TP_SUBSCRIPT;
-        }
-        else if (*id >= WPT_SUP_SRPT)
-        {
-            *id -= WPT_SUP_SRPT;
+        else if (check_tag_type(priv, tag, WPT_CAT_SUP_SRPT, id))
             return TP_SUPERSCRIPT;
-        }
     }
     else if (tag->fg_color_set)
     {
         *color = tag->values->appearance.fg_color;
         return TP_FONTCOLOR;
     }
-    else if (tag->values->font && check_tag_type(tag, WPT_FONT, id))
+    else if (tag->values->font && check_tag_type(priv, tag, WPT_CAT_FONT, id))
         return TP_FONTNAME;
-    else if (tag->values->font && check_tag_type(tag, WPT_FONT_SIZE, id))
+    else if (tag->values->font
+             && check_tag_type(priv, tag, WPT_CAT_FONT_SIZE, id))
         return TP_FONTSIZE;
 
     return TP_BOLD;
@@ -3837,27 +5546,23 @@ write_tags(WPTextBufferPrivate * priv,
     memset(&color, 0x00, sizeof(GdkColor));
     while (tmp && !result)
     {
-        gpointer is_image_ptr;
-        gint is_image;
+        WPTagInfo *tag_info;
         tag = GTK_TEXT_TAG(tmp->data);
         tmp = tmp->next;
-        is_image_ptr = g_object_get_data(G_OBJECT(tag), "image-set");
-        if (is_image_ptr == NULL)
-            is_image = FALSE;
-        else
-            is_image = GPOINTER_TO_INT(is_image_ptr);
-        if (opened && is_image)
+        tag_info = lookup_tag_info(priv, tag);
+        if (opened && tag_info && tag_info->category == WPT_CAT_IMAGE &&
+            !tag_info->index)
         {
-            gchar *image_id;
             gchar *html_image;
-            image_id = g_object_get_data(G_OBJECT(tag), "image-index");
-            html_image = g_strdup_printf("<img src=\"cid:%s\">", image_id);
+            html_image = g_strdup_printf("<img src=\"cid:%s\">",
+                                         tag_info->image_id);
             save(html_image, user_data);
             g_free(html_image);
         }
-        else if (!tag->justification_set && tag != priv->tags[WPT_BULLET])
+        else if (!tag->justification_set &&
+                 !(tag_info && tag_info->category == WPT_CAT_IMAGE))
         {
-            id = convert_tag(priv->tags, tag, &info, &color);
+            id = convert_tag(priv, tag, &info, &color);
 
             if (!opened)
             {
@@ -3968,7 +5673,8 @@ begin_paragraph(WPTextBufferPrivate * priv,
 
     tags = gtk_text_iter_get_tags(start);
     // tags = g_slist_reverse(tags);
-    tag = find_justification_tag(tags, FALSE);
+    tag = get_paragraph(WP_TEXT_BUFFER(gtk_text_iter_get_buffer(start)),
+                        gtk_text_iter_get_line(start))->justification;
 
     if (tag && tag->values->justification != GTK_JUSTIFY_LEFT)
     {
@@ -4039,7 +5745,7 @@ wp_text_buffer_save_document(WPTextBuffer * buffer,
     GtkTextIter start, bend, end, tagtoggle;
     guchar htags[TP_LAST];
     gboolean bullet;
-    gboolean list = FALSE;
+    WPListType list = WP_LIST_NONE, list_type;
     gboolean result = 0;
     gboolean p_opened = FALSE;
     gboolean close_p = FALSE;
@@ -4074,18 +5780,20 @@ wp_text_buffer_save_document(WPTextBuffer * buffer,
             {
                 memset(htags, 0, sizeof(htags));
 
-                bullet =
-                    _wp_text_iter_skip_bullet(&start,
-                                              buffer->priv->tags[WPT_BULLET],
-                                              TRUE);
-                if (bullet ^ list)
+                list_type =
+                    wp_text_buffer_get_list_type(buffer,
+                                                 gtk_text_iter_get_line
+                                                 (&start));
+                bullet = list_type != WP_LIST_NONE;
+                if (list_type != list)
                 {
-                    if (list)
-                        result = save("</ul>\n", user_data);
-                    else
-                        result = save("<ul>\n", user_data);
+                    if (list != WP_LIST_NONE)
+                        result = save(html_list_close_tags[list], user_data);
+                    if (!result && list_type != WP_LIST_NONE)
+                        result = save(html_list_open_tags[list_type],
+                                      user_data);
 
-                    list = bullet;
+                    list = list_type;
                 }
                 if (!result && bullet)
                 {
@@ -4143,8 +5851,8 @@ wp_text_buffer_save_document(WPTextBuffer * buffer,
                                            save, user_data);
             } while (!result && gtk_text_iter_forward_line(&start));
 
-        if (!result && list)
-            result = save("</ul>\n", user_data);
+        if (!result && list != WP_LIST_NONE)
+            result = save(html_list_close_tags[list], user_data);
 
         /* check if last line ends with newline */
         if (!result && !gtk_text_iter_is_start(&start))
@@ -4239,9 +5947,62 @@ debug_print_tags(GtkTextIter * giter, gint what)
  **********************************************/
 
 const gchar **font_name_list;
-const gchar **font_name_list_casefold;
 static gint wp_font_num = 0;
 
+/** Reference to a font name which is not necessarily null terminated */
+typedef struct {
+    const gchar *name;
+    gsize len;
+} WPFontKey;
+
+/** Keys of the font index, pointing into font_name_list */
+static WPFontKey *font_keys = NULL;
+/** Maps the case insensitive font names to their index */
+static GHashTable *font_index = NULL;
+
+/**
+ * Case insensitive hash function of a #WPFontKey
+ * @param key is a pointer to a #WPFontKey
+ * @return the hash value
+ */
+static guint
+font_key_hash(gconstpointer key)
+{
+    const WPFontKey *font_key = key;
+    const gchar *p, *end = font_key->name + font_key->len;
+    guint hash = 5381;
+
+    for (p = font_key->name; p < end; p = g_utf8_next_char(p))
+        hash = hash * 33 + g_unichar_tolower(g_utf8_get_char(p));
+
+    return hash;
+}
+
+/**
+ * Case insensitive comparison of two #WPFontKey
+ * @param a is a pointer to a #WPFontKey
+ * @param b is a pointer to a #WPFontKey
+ * @return <b>TRUE</b> if the two names are equal
+ */
+static gboolean
+font_key_equal(gconstpointer a, gconstpointer b)
+{
+    const WPFontKey *key_a = a, *key_b = b;
+    const gchar *p = key_a->name, *end_a = key_a->name + key_a->len;
+    const gchar *q = key_b->name, *end_b = key_b->name + key_b->len;
+
+    while (p < end_a && q < end_b)
+    {
+        if (g_unichar_tolower(g_utf8_get_char(p)) !=
+            g_unichar_tolower(g_utf8_get_char(q)))
+            return FALSE;
+        p = g_utf8_next_char(p);
+        q = g_utf8_next_char(q);
+    }
+
+    return p >= end_a && q >= end_b;
+}
+
 /**
  * Compare two font families.
  * @param a is a pointer to a character pointer
@@ -4272,46 +6033,318 @@ is_internal_font(const gchar * name)
         || strcmp(name, "Nokia Sans Cn") == 0;
 }
 
-void
-wp_text_buffer_library_init()
+/**
+ * Set the font list and build the font index over it.
+ * @param names is an array of font names, the array and the names are
+ *              owned by the font list from now on
+ * @param n is the number of font names
+ */
+static void
+set_font_list(const gchar ** names, gint n)
+{
+    gint i;
+
+    font_name_list = names;
+    wp_font_num = n;
+
+    font_keys = g_new(WPFontKey, n);
+    font_index = g_hash_table_new(font_key_hash, font_key_equal);
+    for (i = 0; i < wp_font_num; i++)
+    {
+        font_keys[i].name = font_name_list[i];
+        font_keys[i].len = strlen(font_name_list[i]);
+
+        /* Keep the first one from the families which differs only in case */
+        if (!g_hash_table_lookup_extended(font_index, &font_keys[i],
+                                          NULL, NULL))
+            g_hash_table_insert(font_index, &font_keys[i],
+                                GINT_TO_POINTER(i));
+    }
+}
+
+/**
+ * Enumerate the font families known by fontconfig. Used when there is no
+ * display, so Pango can not be asked.
+ * @param n will contain the number of font names
+ * @return a newly allocated array of newly allocated font names
+ */
+static const gchar **
+enumerate_fontconfig_fonts(gint * n)
+{
+    FcPattern *pattern;
+    FcObjectSet *object_set;
+    FcFontSet *font_set;
+    FcChar8 *family;
+    GHashTable *seen;
+    const gchar **names;
+    int i;
+
+    *n = 0;
+    pattern = FcPatternCreate();
+    object_set = FcObjectSetBuild(FC_FAMILY, NULL);
+    font_set = FcFontList(NULL, pattern, object_set);
+    FcObjectSetDestroy(object_set);
+    FcPatternDestroy(pattern);
+
+    if (!font_set)
+        return NULL;
+
+    names = g_new(const gchar *, font_set->nfont);
+    /* Every style of a family is listed separately */
+    seen = g_hash_table_new(g_str_hash, g_str_equal);
+    for (i = 0; i < font_set->nfont; i++)
+    {
+        if (FcPatternGetString(font_set->fonts[i], FC_FAMILY, 0, &family) !=
+            FcResultMatch)
+            continue;
+
+        if (!is_internal_font((const gchar *) family) &&
+            !g_hash_table_lookup(seen, family))
+        {
+            names[*n] = g_strdup((const gchar *) family);
+            g_hash_table_insert(seen, (gpointer) names[*n],
+                                GINT_TO_POINTER(TRUE));
+            (*n)++;
+        }
+    }
+    g_hash_table_destroy(seen);
+    FcFontSetDestroy(font_set);
+
+    names = g_realloc(names, *n * sizeof(gchar *));
+
+    return names;
+}
+
+/**
+ * Enumerate the font families available through Pango, or through
+ * fontconfig when there is no default screen.
+ * @param n will contain the number of font names
+ * @return a newly allocated array of newly allocated font names
+ */
+static const gchar **
+enumerate_fonts(gint * n)
 {
     GdkScreen *screen;
     PangoContext *context;
     PangoFontFamily **families;
-    int i, font_num, n;
+    const gchar **names;
+    int i, font_num;
     const gchar *name;
 
     screen = gdk_screen_get_default();
+    if (!screen)
+        return enumerate_fontconfig_fonts(n);
+
     context = gdk_pango_context_get_for_screen(screen);
     pango_context_list_families(context, &families, &font_num);
 
-    font_name_list = g_new(const gchar *, font_num);
-    n = 0;
+    names = g_new(const gchar *, font_num);
+    *n = 0;
     for (i = 0; i < font_num; i++)
     {
         name = pango_font_family_get_name(families[i]);
 
         if (!is_internal_font(name))
         {
-            font_name_list[n++] = g_strdup(name);
+            names[(*n)++] = g_strdup(name);
         }
     }
 
     // reallocate memory for the "wasted space" to became usable again
-    font_name_list = g_realloc(font_name_list, n * sizeof(gchar *));
-    wp_font_num = n;
+    names = g_realloc(names, *n * sizeof(gchar *));
 
 	/* For some changing order of fonts breaks font handling. This can be
 	reenabled when the actual error is found, NB#70305
-    qsort(font_name_list, n, sizeof(gchar *), cmp_families);
+    qsort(names, *n, sizeof(gchar *), cmp_families);
     */
 
-    font_name_list_casefold = g_new(const gchar *, n);
-    for (i = 0; i < wp_font_num; i++)
-        font_name_list_casefold[i] = g_utf8_casefold(font_name_list[i], -1);
-
     g_free(families);
     g_object_unref(context);
+
+    return names;
+}
+
+/**
+ * Update <i>timestamp</i> with the modification time of the files in
+ * <i>list</i>.
+ * @param list is a fontconfig string list, it will be freed
+ * @param timestamp is the newest modification time found so far
+ */
+static void
+update_fontconfig_timestamp(FcStrList * list, gulong * timestamp)
+{
+    FcChar8 *file;
+    struct stat st;
+
+    if (!list)
+        return;
+
+    while ((file = FcStrListNext(list)))
+        if (g_stat((const gchar *) file, &st) == 0 &&
+            (gulong) st.st_mtime > *timestamp)
+            *timestamp = st.st_mtime;
+
+    FcStrListDone(list);
+}
+
+/**
+ * Query the timestamp of the fontconfig setup, which changes when a font
+ * directory or a configuration file is modified.
+ * @return the newest modification time, or 0 if it is not known
+ */
+static gulong
+get_fontconfig_timestamp()
+{
+    FcConfig *config;
+    gulong timestamp = 0;
+
+    config = FcConfigGetCurrent();
+    if (!config)
+        return 0;
+
+    update_fontconfig_timestamp(FcConfigGetFontDirs(config), &timestamp);
+    update_fontconfig_timestamp(FcConfigGetConfigFiles(config), &timestamp);
+
+    return timestamp;
+}
+
+/**
+ * Read the font list from the cache <i>file</i>. The first line of the file
+ * is the fontconfig timestamp, followed by a font name on each line.
+ * @param file is the name of the cache file
+ * @param timestamp is the current fontconfig timestamp
+ * @param n will contain the number of font names
+ * @return a newly allocated array of newly allocated font names, or
+ *         <b>NULL</b> if the cache is missing or out of date
+ */
+static const gchar **
+read_font_cache(const gchar * file, gulong timestamp, gint * n)
+{
+    gchar *contents, **lines;
+    const gchar **names = NULL;
+    gint i, count;
+
+    if (!g_file_get_contents(file, &contents, NULL, NULL))
+        return NULL;
+
+    lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+
+    count = g_strv_length(lines);
+    /* Every line is terminated, the last one is always empty */
+    if (count >= 2 && !*lines[count - 1] &&
+        strtoul(lines[0], NULL, 10) == timestamp)
+    {
+        *n = count - 2;
+        names = g_new(const gchar *, *n);
+        for (i = 0; i < *n; i++)
+        {
+            names[i] = lines[i + 1];
+            lines[i + 1] = NULL;
+        }
+    }
+
+    for (i = 0; i < count; i++)
+        g_free(lines[i]);
+    g_free(lines);
+
+    return names;
+}
+
+/**
+ * Write the font list to the cache <i>file</i>.
+ * @param file is the name of the cache file
+ * @param timestamp is the current fontconfig timestamp
+ * @param names is an array of font names
+ * @param n is the number of font names
+ */
+static void
+write_font_cache(const gchar * file, gulong timestamp,
+                 const gchar ** names, gint n)
+{
+    GString *contents;
+    gchar *dir;
+    gint i;
+
+    contents = g_string_new(NULL);
+    g_string_append_printf(contents, "%lu\n", timestamp);
+    for (i = 0; i < n; i++)
+    {
+        g_string_append(contents, names[i]);
+        g_string_append_c(contents, '\n');
+    }
+
+    dir = g_path_get_dirname(file);
+    if (g_mkdir_with_parents(dir, 0755) == 0)
+        g_file_set_contents(file, contents->str, contents->len, NULL);
+
+    g_free(dir);
+    g_string_free(contents, TRUE);
+}
+
+/**
+ * Load the font list, if it is not yet loaded. The list is taken from the
+ * cache file if it was written with the current fontconfig setup, otherwise
+ * the fonts are enumerated and the cache is updated.
+ */
+static void
+load_font_list()
+{
+    const gchar **names = NULL;
+    gchar *file;
+    gulong timestamp;
+    gint n = 0;
+
+    if (font_index)
+        return;
+
+    file = g_build_filename(g_get_user_cache_dir(), "wpeditor", "fonts",
+                            NULL);
+    timestamp = get_fontconfig_timestamp();
+
+    if (timestamp)
+        names = read_font_cache(file, timestamp, &n);
+
+    if (!names)
+    {
+        names = enumerate_fonts(&n);
+        /* Only the list got from Pango is cached, the fontconfig one can
+         * have a different order */
+        if (timestamp && gdk_screen_get_default())
+            write_font_cache(file, timestamp, names, n);
+    }
+
+    set_font_list(names, n);
+    g_free(file);
+}
+
+void
+wp_text_buffer_library_init()
+{
+    /* The font list is loaded at it's first use */
+}
+
+void
+wp_text_buffer_library_init_with_fonts(const gchar * const *font_names)
+{
+    const gchar **names;
+    gint i, n;
+
+    g_return_if_fail(font_index == NULL);
+
+    if (!font_names)
+    {
+        load_font_list();
+        return;
+    }
+
+    for (n = 0; font_names[n]; n++);
+
+    names = g_new(const gchar *, n);
+    for (i = 0; i < n; i++)
+        names[i] = g_strdup(font_names[i]);
+
+    set_font_list(names, n);
 }
 
 void
@@ -4320,13 +6353,16 @@ wp_text_buffer_library_done()
     int i;
 
     for (i = 0; i < wp_font_num; i++)
-    {
         g_free((gchar *) font_name_list[i]);
-        g_free((gchar *) font_name_list_casefold[i]);
-    }
 
+    if (font_index)
+        g_hash_table_destroy(font_index);
+    font_index = NULL;
+    g_free(font_keys);
+    font_keys = NULL;
     g_free(font_name_list);
-    g_free(font_name_list_casefold);
+    font_name_list = NULL;
+    wp_font_num = 0;
 
     finalize_html_parser_library();
 }
@@ -4334,8 +6370,7 @@ wp_text_buffer_library_done()
 const gchar *
 wp_get_font_name(gint index)
 {
-    if (!font_name_list)
-        wp_text_buffer_library_init();
+    load_font_list();
 
     if (index >= 0 && index < wp_font_num)
         return font_name_list[index];
@@ -4343,22 +6378,47 @@ wp_get_font_name(gint index)
         return DEF_FONT;
 }
 
+/**
+ * Check if the character can surround a font family name in a list
+ * @param c is the character
+ * @return <b>TRUE</b> if it is a space or a quote
+ */
+static inline gboolean
+is_font_name_delimiter(gchar c)
+{
+    return g_ascii_isspace(c) || c == '"' || c == '\'';
+}
+
 gint
 wp_get_font_index(const gchar * font_name, gint def)
 {
-    gint font;
-    gchar *case_fold = g_utf8_casefold(font_name, -1);
-    
-    if (!font_name_list)
-        wp_text_buffer_library_init();
+    WPFontKey key;
+    const gchar *end;
+    gpointer font;
 
-    for (font = 0; font < wp_font_num; font++)
-        if (g_utf8_collate(font_name_list_casefold[font], case_fold) == 0)
-        {
-            g_free(case_fold);
-            return font;
-        }
-    g_free(case_fold);
+    load_font_list();
+
+    /* The name can be a comma separated list of families, the first one
+     * which is installed is used */
+    while (*font_name)
+    {
+        end = strchr(font_name, ',');
+        if (!end)
+            end = font_name + strlen(font_name);
+
+        key.name = font_name;
+        font_name = *end ? end + 1 : end;
+
+        while (key.name < end && is_font_name_delimiter(*key.name))
+            key.name++;
+        while (end > key.name && is_font_name_delimiter(end[-1]))
+            end--;
+        key.len = end - key.name;
+
+        if (key.len &&
+            g_hash_table_lookup_extended(font_index, &key, NULL, &font))
+            return GPOINTER_TO_INT(font);
+    }
 
     // g_warning("Non existing font: %s", font_name);
     return def;
@@ -4367,8 +6427,7 @@ wp_get_font_index(const gchar * font_name, gint def)
 gint
 wp_get_font_count()
 {
-    if (!font_name_list)
-        wp_text_buffer_library_init();
+    load_font_list();
 
     return wp_font_num;
 }
@@ -4391,8 +6450,22 @@ wp_text_buffer_insert_pixbuf (GtkTextBuffer *buffer,
 			      GtkTextIter *location,
 			      GdkPixbuf *pixbuf)
 {
+    gint offset = gtk_text_iter_get_offset(location);
+    GtkTextIter start;
+
+    begin_paragraph_change(((WPTextBuffer *) buffer)->priv,
+                           gtk_text_iter_get_line(location),
+                           gtk_text_iter_starts_line(location));
     GTK_TEXT_BUFFER_CLASS(wp_text_buffer_parent_class)->
 	insert_pixbuf(buffer, location, pixbuf);
+    ((WPTextBuffer *) buffer)->priv->generation++;
+    update_paragraphs((WPTextBuffer *) buffer);
+
+    /* Every image is marked, so the deletes can find them by the toggles */
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, offset);
+    _apply_tag(((WPTextBuffer *) buffer)->priv, buffer,
+               ((WPTextBuffer *) buffer)->priv->tag_set->image_tag, &start,
+               location);
     
     ((WPTextBuffer *) buffer)->priv->queue_undo_reset = TRUE;
     
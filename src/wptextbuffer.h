@@ -60,7 +60,8 @@ enum {
     WPT_CENTER,
     /** Tag is an align to right style */
     WPT_RIGHT,
-    /** Tag contains a bullet or number */
+    /** Bullet attribute. It has no tag, the list type of the lines is kept
+     * by the buffer and the bullets are painted by the view */
     WPT_BULLET,
     /** Tag contains a foreground color */
     WPT_FORECOLOR,
@@ -100,6 +101,21 @@ typedef enum {
     TEXT_POSITION_SUBSCRIPT
 } TextPosition;
 
+/** Type of a list paragraph */
+typedef enum {
+    /** The paragraph is not part of a list */
+    WP_LIST_NONE = 0,
+    /** Bulleted list */
+    WP_LIST_BULLET,
+    /** List numbered with 1., 2., 3. */
+    WP_LIST_NUMBER,
+    /** List numbered with a., b., c. */
+    WP_LIST_LOWER_ALPHA,
+    /** List numbered with A., B., C. */
+    WP_LIST_UPPER_ALPHA,
+    WP_LIST_LAST
+} WPListType;
+
 /** Format change set, used to notify when a specific style is set */
 typedef struct {
     gint bold:1;
@@ -131,6 +147,24 @@ typedef struct {
     WPTextBufferFormatChangeSet cs;
 } WPTextBufferFormat;
 
+/** A format applied to an interval of the buffer */
+typedef struct {
+    /** Offset of the first character of the interval */
+    gint start;
+    /** Offset after the last character of the interval */
+    gint end;
+    /** The attributes, only the ones present in fmt.cs are applied */
+    WPTextBufferFormat fmt;
+} WPFormatRange;
+
+/** Flags for #wp_text_buffer_apply_formats */
+typedef enum {
+    /** The change is not saved in the undo queue */
+    WP_FORMAT_NO_UNDO = 1 << 0,
+    /** The refresh_attributes signal is not emitted after the change */
+    WP_FORMAT_NO_REFRESH = 1 << 1
+} WPFormatFlags;
+
 /** WPTextBuffer object */
 struct _WPTextBuffer {
     GtkTextBuffer parent;
@@ -225,6 +259,7 @@ wp_text_buffer_get_type(void)
  * @param buffer pointer to a #WPTextBuffer
  * @param tagno contains the tag identifier. It should be between #WPT_BOLD and
  *              WPT_LASTTAG
+ * @return the tag, <b>NULL</b> for #WPT_BULLET which has no tag
  */
   GtkTextTag *wp_text_buffer_get_tag(WPTextBuffer * buffer, gint tagno);
 
@@ -276,6 +311,39 @@ wp_text_buffer_get_type(void)
   gboolean wp_text_buffer_set_format(WPTextBuffer * buffer,
                                      WPTextBufferFormat * fmt);
 
+/**
+ * Apply several formats to several intervals of the buffer in one step. The
+ * ranges are sorted and merged, so every tag is applied only once for every
+ * merged interval. The whole change is saved as one undo operation, and the
+ * refresh_attributes signal is emitted only once. When ranges with different
+ * values of the same attribute overlap, the range starting later wins.
+ * @param buffer pointer to a #WPTextBuffer
+ * @param ranges is an array of #WPFormatRange
+ * @param n is the number of elements in <i>ranges</i>
+ * @param flags is a combination of #WPFormatFlags
+ * @return <b>TRUE</b> if any attribute has been applied
+ */
+  gboolean wp_text_buffer_apply_formats(WPTextBuffer * buffer,
+                                        const WPFormatRange * ranges, gint n,
+                                        guint flags);
+
+/**
+ * Set the list type of the selected lines, or the line of the cursor. The
+ * bullets and the numbers of the numbered lists are not part of the text,
+ * they are drawn by the view.
+ * @param buffer pointer to a #WPTextBuffer
+ * @param type is a #WPListType
+ */
+  void wp_text_buffer_set_list_type(WPTextBuffer * buffer, WPListType type);
+
+/**
+ * Get the list type of a line
+ * @param buffer pointer to a #WPTextBuffer
+ * @param line is a line number in the buffer
+ * @return the #WPListType of the line
+ */
+  WPListType wp_text_buffer_get_list_type(WPTextBuffer * buffer, gint line);
+
 /**
  * Undo the last operation in the buffer.
  * @param buffer pointer to a #WPTextBuffer
@@ -399,6 +467,18 @@ void wp_text_buffer_replace_image (WPTextBuffer *buffer,
                                   const gchar *image_id,
                                   GdkPixbuf *pixbuf);
 
+/**
+ * Replaces the image replacements of several images at once. Every
+ * <i>image_ids</i>[i] is replaced with <i>pixbufs</i>[i].
+ * @param buffer pointer to a #WPTextBuffer
+ * @param image_ids array of image ids
+ * @param pixbufs array of #GdkPixbuf's
+ * @param n number of elements in the arrays
+ */
+void wp_text_buffer_replace_images (WPTextBuffer *buffer,
+                                   const gchar * const *image_ids,
+                                   GdkPixbuf * const *pixbufs, gint n);
+
 /**
  * Removes an image inside the text buffer.
  * @param buffer pointer to a #WPTextBuffer
@@ -414,6 +494,15 @@ void wp_text_buffer_replace_image (WPTextBuffer *buffer,
  */
   void wp_text_buffer_reset_buffer(WPTextBuffer * buffer, gboolean rich_text);
 
+/**
+ * Remove the font, size, color and image tags which are not used anymore
+ * from the tag table. A tag is kept while it is applied in any buffer
+ * sharing the tag table, or it is referenced by their undo records.
+ * It is done automatically when the buffer is reset.
+ * @param buffer pointer to a #WPTextBuffer
+ */
+  void wp_text_buffer_collect_tags(WPTextBuffer * buffer);
+
 /**
  * Prepare the buffer for document loading. The document is loaded in chunck,
  * for better memory usage, and interoperability.
@@ -463,6 +552,8 @@ void wp_text_buffer_replace_image (WPTextBuffer *buffer,
 
 /**
  * Tries to find the insensitive font_name in the detected font list.
+ * A comma separated list of names is also accepted, in which case the
+ * first font found from the list is used.
  * @param font_name is the name of the font we are trying to find
  * @param def is the index of the font for the situation when the font is not found
  * @return the font name index if is found otherwise return def
@@ -485,9 +576,22 @@ void wp_text_buffer_replace_image (WPTextBuffer *buffer,
   gint wp_get_font_count();
 
 /**
- * Initialize the WordPad Text Buffer library
+ * Initialize the WordPad Text Buffer library. The font list is not
+ * enumerated here, it is loaded at it's first use, from a cache file in
+ * the user cache directory if the fontconfig setup hasn't changed since
+ * the cache was written.
  */
   void wp_text_buffer_library_init();
+
+/**
+ * Initialize the WordPad Text Buffer library without a display. Must be
+ * called before any other function of the library.
+ * @param font_names is a <b>NULL</b> terminated list of the font families
+ *                   which can be used. If <b>NULL</b>, the list is loaded
+ *                   from the cache or enumerated through fontconfig.
+ */
+  void wp_text_buffer_library_init_with_fonts(const gchar * const
+                                              *font_names);
 /**
  * Finalize the WordPad Text Buffer library
  */
@@ -55,17 +55,28 @@
  * use this. Uncomment it, if is needed in the future */
 // #define DISABLE_SURROUNDING 1
 
+/** Room of the bullets and the numbers in the left margin, in pixels */
+#define LIST_MARGIN 24
+/** Space between a list label and the text, in pixels */
+#define LIST_LABEL_GAP 4
+
 static GObject *wp_text_view_constructor(GType type,
                                          guint n_construct_properties,
                                          GObjectConstructParam *
                                          construct_param);
 static void wp_text_view_finalize(GObject * object);
 
-/* static gboolean wp_text_view_expose(GtkWidget * widget, GdkEventExpose *
- * event); */
+/**
+ * Callback happening when the view has to be redrawn. Draws the bullets and
+ * the numbers of the lists into the left margin, after the text.
+ * @param widget is a #GtkWidget
+ * @param event is a #GdkEventExpose
+ */
+static gboolean wp_text_view_expose_event(GtkWidget * widget,
+                                          GdkEventExpose * event);
 
 /**
- * Callback happening when the enter was pressed. Needed for bullets.
+ * Callback happening when the enter was pressed. Needed to end the lists.
  * @param view is a #GtkTextView
  * @param event is a #GdkEventKey
  */
@@ -79,27 +90,6 @@ static gboolean handle_enter(WPTextView * view,
  */
 static int wp_text_view_key_press_event(GtkWidget * widget,
                                         GdkEventKey * event);
-/**
- * Callback happening when the cursor was moved. Needed to skip bullets.
- * @param text_view is a #GtkTextView
- * @param step is a #GtkMovementStep
- * @param count is the number of moves
- * @param extend_selection is set if the selection is extended
- */
-static void wp_text_view_move_cursor(GtkTextView * text_view,
-                                     GtkMovementStep step,
-                                     gint count, gboolean extend_selection);
-/**
- * Callback happening at the drag and drop motion.
- * @param widget is a #GtkWidget
- * @param context is a #GdkDragContext
- * @param x is the x coordinate of the motion
- * @param y is the y coordinate of the motion
- * @param time is the time of the event
- */
-static gboolean wp_text_view_drag_motion(GtkWidget * widget,
-                                         GdkDragContext * context,
-                                         gint x, gint y, guint time);
 /**
  * Callback happening at the drop phase of drag and drop
  * @param widget is a #GtkWidget
@@ -124,23 +114,15 @@ static gint wp_text_view_button_press_event(GtkWidget * widget,
                                             GdkEventButton * event);
 
 /**
- * Callback happening when the backspace was pressed. Needed to delete bullets.
+ * Callback happening when the backspace was pressed. Needed to remove the
+ * bullets.
  * @param text_view is a #GtkTextView
  */
 static void wp_text_view_backspace(GtkTextView * text_view);
 
 /**
- * Callback happening when the delete was pressed. Needed to delete bullets.
- * @param text_view is a #GtkTextView
- * @param type is a #GtkDeleteType
- * @param count is the number of deletes
- */
-static void wp_text_view_delete_from_cursor(GtkTextView * text_view,
-                                            GtkDeleteType type, gint count);
-
-/**
- * Callback happening when at the paste operation. Needed for bullets and
- * justification update.
+ * Callback happening when at the paste operation. Needed for justification
+ * update.
  * @param text_view is a #GtkTextView
  */
 static void wp_text_view_paste_clipboard(GtkTextView * text_view);
@@ -176,6 +158,18 @@ static void wp_text_view_background_color_changed(WPTextBuffer * buffer,
                                                   const GdkColor * color,
                                                   GtkTextView * text_view);
 
+/**
+ * Callback happening when the list types of the lines has been changed in
+ * the <i>buffer</i>. Reserves the room of the bullets in the left margin,
+ * while the <i>buffer</i> has list items.
+ * @param buffer is a #GtkTextBuffer
+ * @param has_lists is <b>TRUE</b> if the <i>buffer</i> has list items
+ * @param text_view is a #GtkTextView
+ */
+static void wp_text_view_list_changed(WPTextBuffer * buffer,
+                                      gboolean has_lists,
+                                      GtkTextView * text_view);
+
 
 static void wp_text_view_commit_handler(GtkIMContext * context,
                                         const gchar * str,
@@ -216,14 +210,11 @@ wp_text_view_class_init(WPTextViewClass * klass)
     gobject_class->finalize = wp_text_view_finalize;
 
     widget_class->key_press_event = wp_text_view_key_press_event;
-    widget_class->drag_motion = wp_text_view_drag_motion;
     widget_class->drag_data_received = wp_text_view_drag_data_received;
     widget_class->button_press_event = wp_text_view_button_press_event;
-    // widget_class->expose_event = wp_text_view_expose;
+    widget_class->expose_event = wp_text_view_expose_event;
 
-    text_view_class->move_cursor = wp_text_view_move_cursor;
     text_view_class->backspace = wp_text_view_backspace;
-    text_view_class->delete_from_cursor = wp_text_view_delete_from_cursor;
     text_view_class->paste_clipboard = wp_text_view_paste_clipboard;
 }
 
@@ -288,6 +279,8 @@ wp_text_view_constructor(GType type,
                      view);
     g_signal_connect(G_OBJECT(buffer), "background_color_changed",
                      G_CALLBACK(wp_text_view_background_color_changed), view);
+    g_signal_connect(G_OBJECT(buffer), "list_changed",
+                     G_CALLBACK(wp_text_view_list_changed), view);
 
     return object;
 }
@@ -311,58 +304,91 @@ wp_text_view_new(void)
 /********************************************************************/
 /* Drawing and stuff */
 
-/* static void draw_bullet_at_iter(GtkTextView * text_view, GdkEventExpose *
- * event, GtkTextIter * iter) { GdkRectangle rect; gint radius;
- * 
- * gtk_text_view_get_iter_location(text_view, iter, &rect);
- * gtk_text_view_buffer_to_window_coords(text_view, GTK_TEXT_WINDOW_TEXT,
- * rect.x, rect.y, &rect.x, &rect.y); radius = MIN(rect.width / 2,
- * rect.height / 2) / 3;
- * 
- * gdk_draw_arc(event->window,
- * GTK_WIDGET(text_view)->style->text_gc[GTK_STATE_NORMAL], TRUE, rect.x +
- * rect.width / 2 - radius, rect.y + rect.height / 2 - radius, radius * 2,
- * radius * 2, 0, 360 * 64); }
- * 
- * 
- * static void wp_text_view_draw_bullets(GtkTextView * text_view,
- * GdkEventExpose * event, const GtkTextIter * start, const GtkTextIter *
- * end) { GtkTextIter iter = *start; GtkTextTag *bullet =
- * _wp_text_buffer_get_bullet_tag(WP_TEXT_BUFFER (gtk_text_view_get_buffer
- * (text_view)));
- * 
- * if (!_wp_text_iter_is_bullet(&iter, bullet))
- * gtk_text_iter_forward_to_tag_toggle(&iter, bullet);
- * 
- * while (gtk_text_iter_compare(&iter, end) < 0) { // if
- * (gtk_text_iter_get_char (&iter) == '\t') draw_bullet_at_iter(text_view,
- * event, &iter); gtk_text_iter_forward_to_tag_toggle(&iter, bullet);
- * gtk_text_iter_forward_to_tag_toggle(&iter, bullet); } }
- * 
- * 
- * static gboolean wp_text_view_expose(GtkWidget * widget, GdkEventExpose *
- * event) { gboolean handled; GtkTextView *text_view = GTK_TEXT_VIEW(widget);
- * GtkTextIter start, end; int first_line = 0, last_line = 100000;
- * 
- * GdkRectangle rect = event->area;
- * 
- * gtk_text_view_window_to_buffer_coords (text_view, GTK_TEXT_WINDOW_TEXT,
- * rect.x, rect.y, &rect.x, &rect.y);
- * 
- * gtk_text_view_get_line_at_y (text_view, &start, rect.y, NULL);
- * gtk_text_view_get_line_at_y (text_view, &end, rect.y + rect.height, NULL);
- * gtk_text_iter_forward_line (&end);
- * 
- * first_line = gtk_text_iter_get_line (&start); last_line =
- * gtk_text_iter_get_line (&end);
- * 
- * handled = GTK_WIDGET_CLASS(wp_text_view_parent_class)->expose_event(widget,
- * event);
- * 
- * if (last_line - first_line < 2000) wp_text_view_draw_bullets (text_view,
- * event, &start, &end);
- * 
- * return handled; } */
+/**
+ * Draw the bullets and the labels of the list items in the exposed area,
+ * into the left margin in front of the lines. The text has no bullet, and
+ * the decorations of the lines out of the exposed area are never computed.
+ * @param text_view is a #GtkTextView
+ * @param event is a #GdkEventExpose of the text window
+ */
+static void
+draw_list_items(GtkTextView * text_view, GdkEventExpose * event)
+{
+    GtkWidget *widget = GTK_WIDGET(text_view);
+    WPTextBuffer *buffer =
+        WP_TEXT_BUFFER(gtk_text_view_get_buffer(text_view));
+    GdkGC *gc = widget->style->text_gc[GTK_WIDGET_STATE(widget)];
+    GtkTextIter iter, end;
+    GdkRectangle rect, location;
+    PangoLayout *layout = NULL;
+    WPListType type;
+    gchar *label;
+    gint line, last, width, height, radius;
+
+    rect = event->area;
+    gtk_text_view_window_to_buffer_coords(text_view, GTK_TEXT_WINDOW_TEXT,
+                                          rect.x, rect.y, &rect.x, &rect.y);
+    gtk_text_view_get_line_at_y(text_view, &iter, rect.y, NULL);
+    gtk_text_view_get_line_at_y(text_view, &end, rect.y + rect.height, NULL);
+    last = gtk_text_iter_get_line(&end);
+
+    do
+    {
+        line = gtk_text_iter_get_line(&iter);
+        type = wp_text_buffer_get_list_type(buffer, line);
+        if (type == WP_LIST_NONE)
+            continue;
+
+        gtk_text_view_get_iter_location(text_view, &iter, &location);
+        gtk_text_view_buffer_to_window_coords(text_view, GTK_TEXT_WINDOW_TEXT,
+                                              location.x, location.y,
+                                              &location.x, &location.y);
+
+        if (type == WP_LIST_BULLET ||
+            !(label = _wp_text_buffer_get_list_label(buffer, line)))
+        {
+            radius = MAX(location.height / 8, 1);
+            gdk_draw_arc(event->window, gc, TRUE,
+                         location.x - LIST_MARGIN / 2 - radius,
+                         location.y + location.height / 2 - radius,
+                         radius * 2, radius * 2, 0, 360 * 64);
+            continue;
+        }
+
+        if (!layout)
+            layout = gtk_widget_create_pango_layout(widget, NULL);
+        pango_layout_set_text(layout, label, -1);
+        pango_layout_get_pixel_size(layout, &width, &height);
+        g_free(label);
+
+        /* The label ends a little before the text, a label longer than the
+         * margin is kept in the window */
+        gdk_draw_layout(event->window, gc,
+                        MAX(location.x - LIST_LABEL_GAP - width, 0),
+                        location.y + (location.height - height) / 2, layout);
+    } while (gtk_text_iter_get_line(&iter) < last &&
+             gtk_text_iter_forward_line(&iter));
+
+    if (layout)
+        g_object_unref(layout);
+}
+
+static gboolean
+wp_text_view_expose_event(GtkWidget * widget, GdkEventExpose * event)
+{
+    GtkTextView *text_view = GTK_TEXT_VIEW(widget);
+    gboolean handled;
+
+    handled =
+        GTK_WIDGET_CLASS(wp_text_view_parent_class)->expose_event(widget,
+                                                                  event);
+
+    if (event->window ==
+        gtk_text_view_get_window(text_view, GTK_TEXT_WINDOW_TEXT))
+        draw_list_items(text_view, event);
+
+    return handled;
+}
 
 
 /******************
@@ -419,9 +445,9 @@ static gboolean
 handle_enter(WPTextView * view, G_GNUC_UNUSED GdkEventKey * event)
 {
     GtkTextBuffer *buffer;
-    GtkTextIter start, end, iter;
-    gboolean has_selection, has_bullet, just_remove_bullet;
-    GtkTextTag *bullet;
+    GtkTextIter start, end;
+    gboolean has_selection;
+    gint line;
 
     buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(view));
     has_selection =
@@ -430,25 +456,23 @@ handle_enter(WPTextView * view, G_GNUC_UNUSED GdkEventKey * event)
     if (!gtk_text_iter_can_insert(&start, view->parent.editable))
         return FALSE;
 
-    iter = start;
-    bullet = _wp_text_buffer_get_bullet_tag(WP_TEXT_BUFFER(buffer));
-
-    has_bullet = _wp_text_iter_has_bullet(&iter, bullet) &&
-        !gtk_text_iter_begins_tag(&start, bullet);
-    just_remove_bullet = gtk_text_iter_ends_tag(&start, bullet) &&
-        gtk_text_iter_ends_line(&start);
+    line = gtk_text_iter_get_line(&start);
 
     gtk_text_buffer_begin_user_action(buffer);
-    if (has_selection)
-        gtk_text_buffer_delete(buffer, &start, &end);
 
-    if (just_remove_bullet)
-        _wp_text_iter_remove_bullet_line(&start, bullet);
+    /* An enter on an empty list item ends the list, otherwise the new line
+     * continues the list of the split line */
+    if (!has_selection && gtk_text_iter_starts_line(&start) &&
+        gtk_text_iter_ends_line(&start) &&
+        wp_text_buffer_get_list_type(WP_TEXT_BUFFER(buffer), line) !=
+        WP_LIST_NONE)
+        _wp_text_buffer_set_line_list_type(WP_TEXT_BUFFER(buffer), line,
+                                           WP_LIST_NONE);
     else
     {
+        if (has_selection)
+            gtk_text_buffer_delete(buffer, &start, &end);
         gtk_text_buffer_insert(buffer, &start, "\n", 1);
-        if (has_bullet)
-            _wp_text_iter_put_bullet_line(&start, bullet);
     }
 
     gtk_text_buffer_end_user_action(buffer);
@@ -459,136 +483,6 @@ handle_enter(WPTextView * view, G_GNUC_UNUSED GdkEventKey * event)
 }
 
 
-static void
-wp_text_view_move_cursor(GtkTextView * text_view,
-                         GtkMovementStep step,
-                         gint count, gboolean extend_selection)
-{
-    GtkTextBuffer *buffer;
-    GtkTextMark *insert;
-    GtkTextIter iter;
-    GtkTextTag *bullet;
-
-    GTK_TEXT_VIEW_CLASS(wp_text_view_parent_class)->move_cursor(text_view,
-                                                                step,
-                                                                count,
-                                                                extend_selection);
-
-    if (!text_view->cursor_visible)
-        return;
-
-    buffer = gtk_text_view_get_buffer(text_view);
-    bullet = _wp_text_buffer_get_bullet_tag(WP_TEXT_BUFFER(buffer));
-    insert = gtk_text_buffer_get_insert(buffer);
-    gtk_text_buffer_get_iter_at_mark(buffer, &iter, insert);
-
-    if (                        /* gtk_text_iter_begins_tag(&iter, bullet) || 
-                                 */
-           _wp_text_iter_is_bullet(&iter, bullet)   // &&
-           /* !(gtk_text_iter_ends_tag(&iter, bullet)) */ )
-    {
-        if (count < 0 && (step == GTK_MOVEMENT_LOGICAL_POSITIONS ||
-                          step == GTK_MOVEMENT_VISUAL_POSITIONS ||
-                          step == GTK_MOVEMENT_WORDS))
-        {
-            _wp_text_iter_skip_bullet(&iter, bullet, FALSE);
-            if (gtk_text_iter_is_start(&iter))
-                _wp_text_iter_skip_bullet(&iter, bullet, TRUE);
-            else
-                gtk_text_iter_backward_char(&iter);
-        }
-        else
-        {
-            _wp_text_iter_skip_bullet(&iter, bullet, TRUE);
-        }
-
-        if (extend_selection)
-            gtk_text_buffer_move_mark(buffer, insert, &iter);
-        else
-            gtk_text_buffer_place_cursor(buffer, &iter);
-    }
-}
-
-
-/* taken from gtk */
-
-#define DND_SCROLL_MARGIN 0.20
-
-static gint
-drag_scan_timeout(gpointer data)
-{
-    GtkTextView *text_view = NULL;
-    GtkTextBuffer *buffer = NULL;
-    GtkTextTag *bullet = NULL;
-    GdkWindow *wnd = NULL;
-    GtkTextIter newplace;
-    gint x, y;
-
-    GDK_THREADS_ENTER();
-
-    /* if (data != (gpointer)text_view) { */
-    text_view = GTK_TEXT_VIEW(data);
-    buffer = gtk_text_view_get_buffer(text_view);
-    bullet = _wp_text_buffer_get_bullet_tag(WP_TEXT_BUFFER(buffer));
-    // TODO: It is safe to use as static ?
-    wnd = gtk_text_view_get_window(text_view, GTK_TEXT_WINDOW_TEXT);
-    // }
-
-    gdk_window_get_pointer(wnd, &x, &y, NULL);
-    gtk_text_view_window_to_buffer_coords(text_view, GTK_TEXT_WINDOW_TEXT,
-                                          x, y, &x, &y);
-    gtk_text_layout_get_iter_at_pixel(text_view->layout, &newplace, x, y);
-
-    if (_wp_text_iter_is_bullet(&newplace, bullet))
-        _wp_text_iter_skip_bullet(&newplace, bullet, TRUE);
-
-    gtk_text_buffer_move_mark(buffer, text_view->dnd_mark, &newplace);
-
-    gtk_text_view_scroll_to_mark(text_view,
-                                 text_view->dnd_mark,
-                                 DND_SCROLL_MARGIN, FALSE, 0.0, 0.0);
-
-    GDK_THREADS_LEAVE();
-
-    return TRUE;
-}
-
-
-static gboolean
-wp_text_view_drag_motion(GtkWidget * widget,
-                         GdkDragContext * context, gint x, gint y, guint time)
-{
-    gboolean handled = GTK_WIDGET_CLASS(wp_text_view_parent_class)->
-        drag_motion(widget, context, x, y, time);
-    GtkTextView *text_view = GTK_TEXT_VIEW(widget);
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(text_view);
-    GtkTextIter iter;
-    GtkTextTag *bullet;
-
-    gtk_text_buffer_begin_user_action(buffer);
-    if (handled)
-    {
-        bullet = _wp_text_buffer_get_bullet_tag(WP_TEXT_BUFFER(buffer));
-        gtk_text_buffer_get_iter_at_mark(buffer, &iter, text_view->dnd_mark);
-        if (_wp_text_iter_is_bullet(&iter, bullet))
-        {
-            _wp_text_iter_skip_bullet(&iter, bullet, TRUE);
-            gtk_text_buffer_move_mark(buffer, text_view->dnd_mark, &iter);
-
-            /* Remove the timeout installed by gtk, and install ours */
-            if (text_view->scroll_timeout != 0)
-                g_source_remove(text_view->scroll_timeout);
-
-            text_view->scroll_timeout =
-                g_timeout_add(50, drag_scan_timeout, text_view);
-        }
-    }
-    gtk_text_buffer_end_user_action(buffer);
-
-    return handled;
-}
-
-
 static void
 wp_text_view_drag_data_received(GtkWidget * widget,
                                 GdkDragContext * context,
@@ -599,9 +493,8 @@ wp_text_view_drag_data_received(GtkWidget * widget,
 {
     GtkTextView *text_view = GTK_TEXT_VIEW(widget);
     GtkTextBuffer *buffer = gtk_text_view_get_buffer(text_view);
-    GtkTextTag *bullet = NULL;
     GtkTextIter start, iter;
-    gboolean has_bullet = FALSE, adjust_justification;
+    gboolean adjust_justification;
     gint len = 0;
 
     if (!text_view->dnd_mark)
@@ -611,13 +504,7 @@ wp_text_view_drag_data_received(GtkWidget * widget,
         (selection_data->target ==
          gdk_atom_intern("GTK_TEXT_BUFFER_CONTENTS", FALSE));
     gtk_text_buffer_get_iter_at_mark(buffer, &start, text_view->dnd_mark);
-    if (gtk_text_iter_can_insert(&start, text_view->editable))
-    {
-        /* need to add bullet, if the droped line had bullet */
-        bullet = _wp_text_buffer_get_bullet_tag(WP_TEXT_BUFFER(buffer));
-        has_bullet = _wp_text_iter_has_bullet(&start, bullet);
-    }
-    else
+    if (!gtk_text_iter_can_insert(&start, text_view->editable))
         return;
 
     gtk_text_buffer_begin_user_action(buffer);
@@ -658,19 +545,6 @@ wp_text_view_drag_data_received(GtkWidget * widget,
             _wp_text_buffer_adjust_justification(WP_TEXT_BUFFER(buffer),
                                                  &start, &iter, NULL, FALSE);
     }
-
-    if (bullet)
-    {
-        gtk_text_buffer_get_iter_at_mark(buffer, &iter,
-                                         gtk_text_buffer_get_insert(buffer));
-        if (has_bullet)
-            _wp_text_iter_put_bullet_line(&iter, bullet);
-        else
-        {
-            if (!gtk_text_iter_ends_line(&iter))
-                _wp_text_iter_remove_bullet_line(&iter, bullet);
-        }
-    }
     gtk_text_buffer_end_user_action(buffer);
 }
 
@@ -686,11 +560,10 @@ get_mouse_coords(GtkTextView * text_view, gint * x, gint * y)
                                           GTK_TEXT_WINDOW_TEXT, *x, *y, x, y);
 }
 
-/* Took from gtk and modified a little because we don't want to select
- * bullets */
+/* Took from gtk */
 static void
 move_mark_to_pointer_and_scroll(GtkTextView * text_view,
-                                const gchar * mark_name, GtkTextTag * bullet)
+                                const gchar * mark_name)
 {
     gint x, y;
     GtkTextIter newplace;
@@ -698,8 +571,6 @@ move_mark_to_pointer_and_scroll(GtkTextView * text_view,
     get_mouse_coords(text_view, &x, &y);
 
     gtk_text_layout_get_iter_at_pixel(text_view->layout, &newplace, x, y);
-    if (_wp_text_iter_is_bullet(&newplace, bullet))
-        _wp_text_iter_skip_bullet(&newplace, bullet, TRUE);
 
     {
         GtkTextBuffer *buffer = gtk_text_view_get_buffer(text_view);
@@ -749,7 +620,7 @@ typedef enum {
 static gboolean
 extend_selection(GtkTextView * text_view,
                  SelectionGranularity granularity,
-                 GtkTextIter * start, GtkTextIter * end, GtkTextTag * bullet)
+                 GtkTextIter * start, GtkTextIter * end)
 {
     gboolean extend = TRUE;
 
@@ -789,9 +660,6 @@ extend_selection(GtkTextView * text_view,
             if (!gtk_text_view_starts_display_line(text_view, end))
                 gtk_text_view_forward_display_line_end(text_view, end);
         }
-
-        if (_wp_text_iter_is_bullet(start, bullet))
-            _wp_text_iter_skip_bullet(start, bullet, TRUE);
     }
 
     return extend;
@@ -804,7 +672,6 @@ selection_motion_event_handler(GtkTextView * text_view,
 {
     SelectionGranularity granularity = GPOINTER_TO_INT(data);
     GtkTextBuffer *buffer;
-    GtkTextTag *bullet;
     gint x, y;
     WPTextView *view = WP_TEXT_VIEW(text_view);
 
@@ -813,7 +680,6 @@ selection_motion_event_handler(GtkTextView * text_view,
 
 
     buffer = gtk_text_view_get_buffer(text_view);
-    bullet = _wp_text_buffer_get_bullet_tag(WP_TEXT_BUFFER(buffer));
 
     get_mouse_coords(text_view, &x, &y);
 #define MIN_MOVE 6
@@ -824,7 +690,7 @@ selection_motion_event_handler(GtkTextView * text_view,
     view->my = y;
     if (granularity == SELECT_CHARACTERS)
     {
-        move_mark_to_pointer_and_scroll(text_view, "insert", bullet);
+        move_mark_to_pointer_and_scroll(text_view, "insert");
     }
     else
     {
@@ -834,10 +700,7 @@ selection_motion_event_handler(GtkTextView * text_view,
 
         gtk_text_layout_get_iter_at_pixel(text_view->layout, &start, x, y);
 
-        if (_wp_text_iter_is_bullet(&start, bullet))
-            _wp_text_iter_skip_bullet(&start, bullet, TRUE);
-
-        if (extend_selection(text_view, granularity, &start, &end, bullet))
+        if (extend_selection(text_view, granularity, &start, &end))
         {
             /* Extend selection */
             gtk_text_buffer_get_iter_at_mark(buffer,
@@ -915,7 +778,6 @@ gtk_text_view_start_selection_drag(GtkTextView * text_view,
 {
     GtkTextIter start, end;
     GtkTextBuffer *buffer;
-    GtkTextTag *bullet;
     WPTextView *view = WP_TEXT_VIEW(text_view);
     SelectionGranularity granularity;
 
@@ -933,13 +795,9 @@ gtk_text_view_start_selection_drag(GtkTextView * text_view,
     gtk_grab_add(GTK_WIDGET(text_view));
 
     buffer = gtk_text_view_get_buffer(text_view);
-    bullet = _wp_text_buffer_get_bullet_tag(WP_TEXT_BUFFER(buffer));
 
     start = *iter;
-    if (_wp_text_iter_is_bullet(&start, bullet))
-        _wp_text_iter_skip_bullet(&start, bullet, TRUE);
-
-    extend_selection(text_view, granularity, &start, &end, bullet);
+    extend_selection(text_view, granularity, &start, &end);
 
     if (button->state & GDK_SHIFT_MASK)
     {
@@ -989,8 +847,7 @@ gtk_text_view_end_selection_drag(GtkTextView * text_view,
 }
 
 
-/* Took from the gtk with little modification, to not be able to select the
- * bullet */
+/* Took from the gtk with little modification */
 static gint
 wp_text_view_button_press_event(GtkWidget * widget, GdkEventButton * event)
 {
@@ -1080,27 +937,26 @@ static void
 wp_text_view_backspace(GtkTextView * text_view)
 {
     GtkTextBuffer *buffer = gtk_text_view_get_buffer(text_view);
-    GtkTextIter end;
+    WPTextBuffer *wp_buffer = WP_TEXT_BUFFER(buffer);
+    GtkTextIter iter;
     gboolean run_parent = TRUE;
+    gint line;
 
     gtk_text_buffer_begin_user_action(buffer);
-    if (!gtk_text_buffer_get_selection_bounds(buffer, &end, NULL))
+    if (!gtk_text_buffer_get_selection_bounds(buffer, &iter, NULL) &&
+        gtk_text_iter_starts_line(&iter))
     {
-        GtkTextIter start, iter;
-        GtkTextTag *bullet =
-            _wp_text_buffer_get_bullet_tag(WP_TEXT_BUFFER(buffer));
-
-        iter = end;
-        if (gtk_text_iter_ends_tag(&end, bullet))
+        /* At the start of a list item only the bullet is removed, unless
+         * the previous line is a list item too, then the lines are joined */
+        line = gtk_text_iter_get_line(&iter);
+        if (wp_text_buffer_get_list_type(wp_buffer, line) != WP_LIST_NONE &&
+            (line == 0 ||
+             wp_text_buffer_get_list_type(wp_buffer, line - 1) ==
+             WP_LIST_NONE))
         {
-            if (gtk_text_iter_backward_line(&iter) &&
-                !_wp_text_iter_has_bullet(&iter, bullet))
-                run_parent = FALSE;
-
-            start = end;
-            gtk_text_iter_backward_char(&start);
-            _wp_text_iter_skip_bullet(&start, bullet, FALSE);
-            gtk_text_buffer_delete(buffer, &start, &end);
+            _wp_text_buffer_set_line_list_type(wp_buffer, line,
+                                               WP_LIST_NONE);
+            run_parent = FALSE;
         }
     }
 
@@ -1110,57 +966,20 @@ wp_text_view_backspace(GtkTextView * text_view)
     gtk_text_buffer_end_user_action(buffer);
 }
 
-
-static void
-wp_text_view_delete_from_cursor(GtkTextView * text_view,
-                                GtkDeleteType type, gint count)
-{
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(text_view);
-    gboolean had_selection =
-        gtk_text_buffer_get_selection_bounds(buffer, NULL, NULL);
-
-    gtk_text_buffer_begin_user_action(buffer);
-    GTK_TEXT_VIEW_CLASS(wp_text_view_parent_class)->
-        delete_from_cursor(text_view, type, count);
-    if (!had_selection)
-    {
-        GtkTextIter start, end;
-        GtkTextTag *bullet =
-            _wp_text_buffer_get_bullet_tag(WP_TEXT_BUFFER(buffer));
-
-        gtk_text_buffer_get_iter_at_mark(buffer, &start,
-                                         gtk_text_buffer_get_insert(buffer));
-        if (gtk_text_iter_begins_tag(&start, bullet))
-        {
-            end = start;
-            _wp_text_iter_skip_bullet(&end, bullet, TRUE);
-            gtk_text_buffer_delete(buffer, &start, &end);
-        }
-    }
-    gtk_text_buffer_end_user_action(buffer);
-}
-
-/* TODO: maybe it would be better, if the WPTextView will use a separate
- * clipboard content than GtkTextBuffer. It is important for bullets. When
- * the bullets are on, and the clipboard is not containing a WPTextView
- * buffer, it should bulletize each line of the pasted text */
+/* The pasted lines continue the list of the line at the cursor, only the
+ * justification has to be adjusted */
 static void
 wp_text_view_paste_clipboard(GtkTextView * text_view)
 {
     GtkTextBuffer *buffer = gtk_text_view_get_buffer(text_view);
     /* GtkClipboard *clipboard = gtk_widget_get_clipboard (GTK_WIDGET
      * (text_view), GDK_SELECTION_CLIPBOARD); gboolean simple_text; */
-    GtkTextTag *bullet = NULL;
     GtkTextIter start, iter;
     gint offset;
-    gboolean has_bullet = FALSE;
 
     gtk_text_buffer_get_selection_bounds(buffer, &iter, NULL);
     offset = gtk_text_iter_get_offset(&iter);
 
-    bullet = _wp_text_buffer_get_bullet_tag(WP_TEXT_BUFFER(buffer));
-    has_bullet = _wp_text_iter_has_bullet(&iter, bullet);
-
     gtk_text_buffer_begin_user_action(buffer);
     /* simple_text = !gtk_clipboard_wait_is_target_available (clipboard,
      * gdk_atom_intern ("WP_TEXT_VIEW", FALSE)); */
@@ -1190,17 +1009,6 @@ wp_text_view_paste_clipboard(GtkTextView * text_view)
         _wp_text_buffer_adjust_justification(WP_TEXT_BUFFER(buffer),
                                              &start, &iter, NULL, FALSE);
 
-    if (bullet)
-    {
-        if (has_bullet)
-            _wp_text_iter_put_bullet_line(&iter, bullet);
-        else
-        {
-            if (!gtk_text_iter_ends_line(&iter))
-                _wp_text_iter_remove_bullet_line(&iter, bullet);
-        }
-    }
-
     gtk_text_buffer_end_user_action(buffer);
 }
 
@@ -1227,6 +1035,24 @@ wp_text_view_def_justification_changed(WPTextBuffer * buffer,
     gtk_text_view_set_justification(text_view, justification);
 }
 
+static void
+wp_text_view_list_changed(WPTextBuffer * buffer, gboolean has_lists,
+                          GtkTextView * text_view)
+{
+    WPTextView *view = WP_TEXT_VIEW(text_view);
+    gint margin = gtk_text_view_get_left_margin(text_view);
+
+    if (!has_lists != !view->list_margin)
+    {
+        view->list_margin = has_lists != FALSE;
+        gtk_text_view_set_left_margin(text_view,
+                                      has_lists ? margin + LIST_MARGIN :
+                                      margin - LIST_MARGIN);
+    }
+
+    gtk_widget_queue_draw(GTK_WIDGET(text_view));
+}
+
 /* IM Handling - mostly taken from gtk */
 static void
 wp_text_view_commit_handler(GtkIMContext * context,
@@ -1275,8 +1101,8 @@ wp_text_view_commit_text(GtkTextView * text_view, const gchar * text)
                                              (gtk_text_view_get_buffer
                                               (text_view), "insert"));
             if (!gtk_text_iter_ends_line(&insert))
-                wp_text_view_delete_from_cursor(text_view, GTK_DELETE_CHARS,
-                                                1);
+                GTK_TEXT_VIEW_CLASS(wp_text_view_parent_class)->
+                    delete_from_cursor(text_view, GTK_DELETE_CHARS, 1);
         }
         gtk_text_buffer_insert_interactive_at_cursor(gtk_text_view_get_buffer
                                                      (text_view), text, -1,
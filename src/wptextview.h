@@ -49,6 +49,7 @@ struct _WPTextView {
 
     gint mx, my;
     gboolean in_action;
+    gboolean list_margin;
 };
 
 /** WPTextView class */
@@ -52,6 +52,7 @@ typedef enum {
     WP_UNDO_SELECT,
     WP_UNDO_FMT,
     WP_UNDO_LAST_LINE_JUSTIFY,
+    WP_UNDO_LIST,
 } WPUndoType;
 
 /** An undo operation type */
@@ -69,6 +70,10 @@ typedef struct {
     gint sel_end;
     gint old_line_justify;
     gint new_line_justify;
+    gint line;
+    gint n_lists;
+    guint8 *orig_lists;
+    guint8 *lists;
     gchar mergeable:1;
     gchar backspace:1;
     gchar rich_text:1;
@@ -566,18 +571,13 @@ wp_undo_apply_saved_tags(GtkTextBuffer * buffer, GSList * tags)
             if (tag_name != NULL && 
                     g_str_has_prefix (tag_name, "image-tag-") &&
                     !g_str_has_prefix (tag_name, "image-tag-replace-")) {
-                gchar *new_name;
                 const gchar *image_id;
-                image_id = g_object_get_data (G_OBJECT (tag->tag), "image-index");
+                image_id = _wp_text_buffer_get_image_id (WP_TEXT_BUFFER (buffer),
+                                                         tag->tag);
                 if (image_id != NULL) {
-                    GtkTextTagTable *tag_table;
                     gtk_text_buffer_remove_tag (buffer, tag->tag, &s, &e);
-                    new_name = g_strdup_printf ("image-tag-replace-%s", image_id);
-                    tag_table = gtk_text_buffer_get_tag_table (buffer);
-                    tag->tag = gtk_text_tag_table_lookup (tag_table, new_name);
-                    if (tag->tag == NULL)
-                        tag->tag = gtk_text_buffer_create_tag (buffer, new_name, NULL);
-                    g_free (new_name);
+                    tag->tag = _wp_text_buffer_get_image_replace_tag
+                        (WP_TEXT_BUFFER (buffer), image_id, TRUE);
                     gtk_text_buffer_apply_tag (buffer, tag->tag, &s, &e);
                 }
             } else {
@@ -635,24 +635,6 @@ wp_undo_redo_selection(GtkTextBuffer * text_buffer, GSList * queue,
         gtk_text_buffer_select_range(text_buffer, &start, &end);
 }
 
-/**
- * Skip a bullet tag at the cursor position if there is any.
- * @param text_buffer is a #GtkTextBuffer associated with the undo
- */
-static void
-wp_undo_skip_bullet_at_cursor(GtkTextBuffer * text_buffer)
-{
-
-    WPTextBuffer *buffer = WP_TEXT_BUFFER(text_buffer);
-    GtkTextTag *tag = _wp_text_buffer_get_bullet_tag(buffer);
-    GtkTextIter pos;
-
-    gtk_text_buffer_get_iter_at_mark(text_buffer, &pos,
-                                     gtk_text_buffer_get_insert(text_buffer));
-    if (_wp_text_iter_skip_bullet(&pos, tag, TRUE))
-        gtk_text_buffer_place_cursor(text_buffer, &pos);
-}
-
 void
 wp_undo_undo(WPUndo * undo)
 {
@@ -707,6 +689,13 @@ wp_undo_undo(WPUndo * undo)
 
                 wp_undo_apply_saved_tags(text_buffer, op->tags);
 
+                /* The reinserted lines got the list of the line where they
+                 * were inserted */
+                if (op->lists)
+                    _wp_text_buffer_set_list_types(WP_TEXT_BUFFER
+                                                   (text_buffer), op->line,
+                                                   op->lists, op->n_lists);
+
                 break;
 
             case WP_UNDO_INSERT:
@@ -715,21 +704,7 @@ wp_undo_undo(WPUndo * undo)
                 gtk_text_buffer_get_iter_at_offset(text_buffer, &end,
                                                    op->end);
 
-            	/* Bullet are also handled in insert */
-            	if( gtk_text_iter_toggles_tag( &start,
-	            	_wp_text_buffer_get_bullet_tag(
-	            		WP_TEXT_BUFFER( text_buffer ) ) ) ) {
-	            		
-            		GtkTextIter at = start;
-            		while( gtk_text_iter_ends_line( &at ) ) {
-            			++proposed_cursor_pos;
-						gtk_text_buffer_get_iter_at_offset(text_buffer, &at,
-							1 );		
-            		}
-            		
-				} else {
-					proposed_cursor_pos = op->start;
-				}
+                proposed_cursor_pos = op->start;
 
                 gtk_text_buffer_delete(text_buffer, &start, &end);
 
@@ -793,6 +768,11 @@ wp_undo_undo(WPUndo * undo)
                 g_signal_emit(G_OBJECT(undo), signals[LAST_LINE_JUSTIFY], 0,
                               op->old_line_justify);
                 break;
+            case WP_UNDO_LIST:
+                _wp_text_buffer_set_list_types(WP_TEXT_BUFFER(text_buffer),
+                                               op->line, op->orig_lists,
+                                               op->n_lists);
+                break;
 
             default:
                 g_warning
@@ -891,10 +871,7 @@ wp_undo_redo(WPUndo * undo)
                 break;
             case WP_UNDO_FMT:
                 if (op->rich_text)
-                {
                     wp_undo_apply_saved_tags(text_buffer, op->tags);
-                    wp_undo_skip_bullet_at_cursor(text_buffer);
-                }
                 else
                 {
                     gtk_text_buffer_get_bounds(text_buffer, &start, &end);
@@ -920,6 +897,11 @@ wp_undo_redo(WPUndo * undo)
                 g_signal_emit(G_OBJECT(undo), signals[LAST_LINE_JUSTIFY], 0,
                               op->new_line_justify);
                 break;
+            case WP_UNDO_LIST:
+                _wp_text_buffer_set_list_types(WP_TEXT_BUFFER(text_buffer),
+                                               op->line, op->lists,
+                                               op->n_lists);
+                break;
 
             default:
                 g_warning
@@ -983,6 +965,8 @@ wp_undo_free_op_list(GSList * queue)
             if (act)
             {
                 g_free(act->text);
+                g_free(act->orig_lists);
+                g_free(act->lists);
                 wp_undo_free_tags(act->orig_tags);
                 wp_undo_free_tags(act->tags);
             }
@@ -1203,6 +1187,7 @@ wp_undo_delete_range(WPUndo * undo, GtkTextIter * start, GtkTextIter * end)
     gboolean mergeable = FALSE;
     gboolean is_space;
     gchar *str = NULL;
+    gint i;
 
     g_return_if_fail(WP_IS_UNDO(undo));
 
@@ -1271,6 +1256,47 @@ wp_undo_delete_range(WPUndo * undo, GtkTextIter * start, GtkTextIter * end)
     op->tags = wp_undo_get_toggled_tags(undo, start, end);
     undo->priv->last_char_is_space = is_space;
 
+    /* The list types of the joined lines are lost by the delete */
+    op->line = gtk_text_iter_get_line(start);
+    op->n_lists = gtk_text_iter_get_line(end) - op->line + 1;
+    if (op->n_lists > 1)
+    {
+        op->lists = g_new(guint8, op->n_lists);
+        for (i = 0; i < op->n_lists; i++)
+            op->lists[i] =
+                wp_text_buffer_get_list_type(WP_TEXT_BUFFER
+                                             (undo->priv->text_buffer),
+                                             op->line + i);
+    }
+
+    wp_undo_add_queue(undo, op);
+}
+
+void
+wp_undo_insert_range(WPUndo * undo, GtkTextIter * start, GtkTextIter * end)
+{
+    WPUndoOperation *op;
+
+    g_return_if_fail(WP_IS_UNDO(undo));
+
+    if (undo->priv->undo_disabled > 0 || undo->priv->low_mem)
+        return;
+
+    op = g_new0(WPUndoOperation, 1);
+    op->type = WP_UNDO_INSERT;
+    op->start = gtk_text_iter_get_offset(start);
+    op->end = gtk_text_iter_get_offset(end);
+    op->text =
+        gtk_text_buffer_get_slice(undo->priv->text_buffer, start, end, TRUE);
+    if (!op->text)
+    {
+        emit_no_memory(undo);
+        g_free(op);
+        return;
+    }
+
+    op->tags = wp_undo_get_toggled_tags(undo, start, end);
+
     wp_undo_add_queue(undo, op);
 }
 
@@ -1427,6 +1453,16 @@ wp_undo_selection_changed(WPUndo * undo, GtkTextIter * start,
     }
 }
 
+void
+wp_undo_close_select(WPUndo * undo)
+{
+    g_return_if_fail(WP_IS_UNDO(undo));
+
+    if (undo->priv->current_op &&
+        undo->priv->current_op->type == WP_UNDO_SELECT)
+        undo->priv->current_op->mergeable = FALSE;
+}
+
 void
 wp_undo_format_changed(WPUndo * undo, gboolean rich_text)
 {
@@ -1481,6 +1517,27 @@ wp_undo_last_line_justify(WPUndo * undo, gint old_line_justify,
     wp_undo_add_queue(undo, op);
 }
 
+void
+wp_undo_list_types(WPUndo * undo, gint line, gint n_lists,
+                   const guint8 * orig_lists, const guint8 * lists)
+{
+    WPUndoOperation *op;
+
+    g_return_if_fail(WP_IS_UNDO(undo));
+
+    if (undo->priv->undo_disabled > 0 || undo->priv->low_mem)
+        return;
+
+    op = g_new0(WPUndoOperation, 1);
+    op->type = WP_UNDO_LIST;
+    op->line = line;
+    op->n_lists = n_lists;
+    op->orig_lists = g_memdup(orig_lists, n_lists);
+    op->lists = g_memdup(lists, n_lists);
+
+    wp_undo_add_queue(undo, op);
+}
+
 void
 remove_image_tags (gchar **string)
 {
@@ -1522,6 +1579,8 @@ wp_undo_add_queue(WPUndo * undo, WPUndoOperation * op)
     	
 	/*bug 140583*/
 	g_free(op->text);
+        g_free(op->orig_lists);
+        g_free(op->lists);
         g_free(op);
         return;
     }
@@ -1558,6 +1617,48 @@ wp_undo_add_queue(WPUndo * undo, WPUndoOperation * op)
     wp_undo_send_signals(undo);
 }
 
+/**
+ * Add the tags referenced by the operations of the <i>queue</i> to the
+ * <i>tags</i> hash table.
+ * @param queue is a list of operation lists
+ * @param tags is a #GHashTable
+ */
+static void
+wp_undo_collect_queue_tags(GSList * queue, GHashTable * tags)
+{
+    GSList *action_list, *tmp;
+    WPUndoOperation *act;
+
+    for (; queue; queue = queue->next)
+        for (action_list = (GSList *) queue->data; action_list;
+             action_list = action_list->next)
+        {
+            act = (WPUndoOperation *) action_list->data;
+            if (!act)
+                continue;
+
+            if (act->tag)
+                g_hash_table_insert(tags, act->tag, act->tag);
+            if (act->orig_tag)
+                g_hash_table_insert(tags, act->orig_tag, act->orig_tag);
+            for (tmp = act->tags; tmp; tmp = tmp->next)
+                g_hash_table_insert(tags, ((WPUndoTag *) tmp->data)->tag,
+                                    ((WPUndoTag *) tmp->data)->tag);
+            for (tmp = act->orig_tags; tmp; tmp = tmp->next)
+                g_hash_table_insert(tags, ((WPUndoTag *) tmp->data)->tag,
+                                    ((WPUndoTag *) tmp->data)->tag);
+        }
+}
+
+void
+wp_undo_collect_tags(WPUndo * undo, GHashTable * tags)
+{
+    g_return_if_fail(WP_IS_UNDO(undo));
+
+    wp_undo_collect_queue_tags(undo->priv->undo_queue, tags);
+    wp_undo_collect_queue_tags(undo->priv->redo_queue, tags);
+}
+
 void
 wp_undo_reset(WPUndo * undo)
 {
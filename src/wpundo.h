@@ -171,6 +171,17 @@ wp_undo_get_type(void)
    
       wp_undo_delete_range(WPUndo * undo,
                            GtkTextIter * start, GtkTextIter * end);
+/**
+ * Register the text already present between <i>start</i> and <i>end</i>,
+ * together with its tags, as a single insert operation
+ * @param undo pointer to the undo object
+ * @param start contains the start position of the inserted text
+ * @param end contains the end position of the inserted text
+ */
+  void
+   
+      wp_undo_insert_range(WPUndo * undo,
+                           GtkTextIter * start, GtkTextIter * end);
 /**
  * Register a new tag change operation to the undo queue
  * @param undo pointer to the undo object
@@ -209,6 +220,13 @@ wp_undo_get_type(void)
    
       wp_undo_selection_changed(WPUndo * undo, GtkTextIter * start,
                                 GtkTextIter * end);
+/**
+ * Close the current selection operation, so no later selection change is
+ * merged into it. After this, a selection change without selection is
+ * not recorded anymore.
+ * @param undo pointer to the undo object
+ */
+  void wp_undo_close_select(WPUndo * undo);
 
 /**
  * Register a new format change operation to the undo queue.
@@ -226,6 +244,17 @@ wp_undo_get_type(void)
   void wp_undo_last_line_justify(WPUndo * undo, gint old_line_justify,
                                  gint new_line_justify);
 
+/**
+ * Register a list type change of the lines to the undo queue.
+ * @param undo pointer to the undo object
+ * @param line is the first changed line
+ * @param n_lists is the number of the changed lines
+ * @param orig_lists contains the old #WPListType of the lines
+ * @param lists contains the new #WPListType of the lines
+ */
+  void wp_undo_list_types(WPUndo * undo, gint line, gint n_lists,
+                          const guint8 * orig_lists, const guint8 * lists);
+
 /**
  * Queries the undo enable state
  * @param undo pointer to the undo object
@@ -245,5 +274,12 @@ wp_undo_get_type(void)
  */
   void wp_undo_reset(WPUndo * undo);
 
+/**
+ * Collect the tags referenced by the undo and redo queues
+ * @param undo pointer to the undo object
+ * @param tags is a #GHashTable where the referenced tags are inserted as keys
+ */
+  void wp_undo_collect_tags(WPUndo * undo, GHashTable * tags);
+
 G_END_DECLS
 #endif /* _WP_UNDO_H */